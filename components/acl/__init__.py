@@ -1,3 +1,5 @@
+import re
+
 import esphome.codegen as cg
 import esphome.config_validation as cv
 from esphome.components.esp32 import add_idf_sdkconfig_option
@@ -5,6 +7,8 @@ from esphome import automation
 from esphome.core import CORE
 from esphome.const import (
     CONF_ID,
+    CONF_KEY,
+    CONF_NAME,
 )
 from esphome.components import time, web_server_base, sdmmc
 from esphome.components.web_server_base import CONF_WEB_SERVER_BASE_ID
@@ -19,10 +23,40 @@ AclComponent = acl_ns.class_("AclComponent", cg.Component)
 
 # Actions
 AclTestAction = acl_ns.class_("AclTestAction", automation.Action)
+AclBeginBatchAction = acl_ns.class_("AclBeginBatchAction", automation.Action)
+AclCommitAction = acl_ns.class_("AclCommitAction", automation.Action)
+AclAddAction = acl_ns.class_("AclAddAction", automation.Action)
+AclRemoveAction = acl_ns.class_("AclRemoveAction", automation.Action)
 
 CONF_CLOCK_ID = "clock_id"
 CONF_SDMMC_ID = "sdmmc_id"
 CONF_PATH = "path"
+CONF_LOG_BUFFER_SIZE = "log_buffer_size"
+CONF_LOG_FLUSH_INTERVAL = "log_flush_interval"
+CONF_LOG_FORMAT = "log_format"
+CONF_LOG_MAX_AGE = "log_max_age"
+CONF_LOG_MAX_SIZE = "log_max_size"
+CONF_LOG_COMPRESS = "log_compress"
+CONF_MAX_OPEN_SOCKETS = "max_open_sockets"
+
+LogFormat = acl_ns.enum("LogFormat")
+LOG_FORMATS = {
+    "text": LogFormat.LOG_FORMAT_TEXT,
+    "binary": LogFormat.LOG_FORMAT_BINARY,
+}
+
+SIZE_UNITS = {"": 1, "K": 1024, "M": 1024**2, "G": 1024**3}
+
+
+def size_in_bytes(value):
+    """Accepts a byte count such as 1048576, "512KB" or "64MB"."""
+    if isinstance(value, int):
+        return cv.int_range(min=0, max=2**32 - 1)(value)
+    match = re.match(r"^(\d+)\s*([KMG]?)B?$", cv.string(value).strip(), re.IGNORECASE)
+    if match is None:
+        raise cv.Invalid(f"Invalid size {value}, expected a number of bytes such as 512KB or 64MB")
+    return cv.int_range(min=0, max=2**32 - 1)(int(match.group(1)) * SIZE_UNITS[match.group(2).upper()])
+
 
 CONFIG_SCHEMA = cv.Schema(
     {
@@ -30,6 +64,15 @@ CONFIG_SCHEMA = cv.Schema(
         cv.Required(CONF_CLOCK_ID): cv.use_id(time.RealTimeClock),
         cv.Required(CONF_SDMMC_ID): cv.use_id(sdmmc.SdMmcComponent),
         cv.Required(CONF_PATH): cv.templatable(cv.string_strict),
+        cv.Optional(CONF_LOG_BUFFER_SIZE, default=64): cv.int_range(min=4, max=4096),
+        cv.Optional(CONF_LOG_FLUSH_INTERVAL, default="5s"): cv.positive_time_period_milliseconds,
+        cv.Optional(CONF_LOG_FORMAT, default="text"): cv.enum(LOG_FORMATS, lower=True),
+        cv.Optional(CONF_LOG_MAX_AGE): cv.All(
+            cv.positive_time_period_seconds, cv.Range(min=cv.TimePeriod(days=1))
+        ),
+        cv.Optional(CONF_LOG_MAX_SIZE): size_in_bytes,
+        cv.Optional(CONF_LOG_COMPRESS, default=True): cv.boolean,
+        cv.Optional(CONF_MAX_OPEN_SOCKETS, default=4): cv.int_range(min=1, max=16),
         # cv.GenerateID(CONF_WEB_SERVER_BASE_ID): cv.use_id(
         #     web_server_base.WebServerBase
         # ),
@@ -45,6 +88,69 @@ async def to_code(config):
     cg.add(var.set_sdmmc(sdmmc))
     path_ = await cg.templatable(config[CONF_PATH], [], cg.std_string)
     cg.add(var.set_path(path_))
+    cg.add(var.set_log_buffer_size(config[CONF_LOG_BUFFER_SIZE]))
+    cg.add(var.set_log_flush_interval(config[CONF_LOG_FLUSH_INTERVAL]))
+    cg.add(var.set_log_format(config[CONF_LOG_FORMAT]))
+    if CONF_LOG_MAX_AGE in config:
+        cg.add(var.set_log_max_age(config[CONF_LOG_MAX_AGE].total_days))
+    if CONF_LOG_MAX_SIZE in config:
+        cg.add(var.set_log_max_size(config[CONF_LOG_MAX_SIZE]))
+    cg.add(var.set_log_compress(config[CONF_LOG_COMPRESS]))
+    cg.add(var.set_max_open_sockets(config[CONF_MAX_OPEN_SOCKETS]))
 
     # web_base = await cg.get_variable(config[CONF_WEB_SERVER_BASE_ID])
     # cg.add(var.set_webserver(web_base))
+
+
+@automation.register_action(
+    "acl.begin_batch",
+    AclBeginBatchAction,
+    cv.Schema({cv.GenerateID(): cv.use_id(AclComponent)}),
+)
+async def acl_begin_batch_to_code(config, action_id, template_arg, args):
+    paren = await cg.get_variable(config[CONF_ID])
+    var = cg.new_Pvariable(action_id, template_arg, paren)
+    return var
+
+@automation.register_action(
+    "acl.commit",
+    AclCommitAction,
+    cv.Schema({cv.GenerateID(): cv.use_id(AclComponent)}),
+)
+async def acl_commit_to_code(config, action_id, template_arg, args):
+    paren = await cg.get_variable(config[CONF_ID])
+    var = cg.new_Pvariable(action_id, template_arg, paren)
+    return var
+
+ACL_ADD_SCHEMA = cv.Schema(
+    {
+        cv.GenerateID(): cv.use_id(AclComponent),
+        cv.Required(CONF_NAME): cv.templatable(cv.string_strict),
+        cv.Required(CONF_KEY): cv.templatable(cv.string_strict),
+    }
+)
+
+@automation.register_action("acl.add", AclAddAction, ACL_ADD_SCHEMA)
+async def acl_add_to_code(config, action_id, template_arg, args):
+    paren = await cg.get_variable(config[CONF_ID])
+    var = cg.new_Pvariable(action_id, template_arg, paren)
+    template_ = await cg.templatable(config[CONF_NAME], args, cg.std_string)
+    cg.add(var.set_name(template_))
+    template_ = await cg.templatable(config[CONF_KEY], args, cg.std_string)
+    cg.add(var.set_key(template_))
+    return var
+
+ACL_REMOVE_SCHEMA = cv.Schema(
+    {
+        cv.GenerateID(): cv.use_id(AclComponent),
+        cv.Required(CONF_NAME): cv.templatable(cv.string_strict),
+    }
+)
+
+@automation.register_action("acl.remove", AclRemoveAction, ACL_REMOVE_SCHEMA)
+async def acl_remove_to_code(config, action_id, template_arg, args):
+    paren = await cg.get_variable(config[CONF_ID])
+    var = cg.new_Pvariable(action_id, template_arg, paren)
+    template_ = await cg.templatable(config[CONF_NAME], args, cg.std_string)
+    cg.add(var.set_name(template_))
+    return var
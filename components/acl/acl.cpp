@@ -1,9 +1,11 @@
 #include "acl.h"
 #include "util.h"
 
+#include <algorithm>
 #include <sstream>
 #include <iomanip>
 
+#include "esphome/core/helpers.h"
 #include "esphome/core/log.h"
 
 namespace esphome {
@@ -15,7 +17,10 @@ void AclComponent::dump_config() {
 }
 
 void AclComponent::setup() {
+  logs_.init(log_buffer_size_);
   store_.set_path(path_);
+  store_.set_log_format(log_format_);
+  store_.set_log_retention(log_max_age_, log_max_size_, log_compress_);
   if (sdmmc_ != nullptr) {
     store_.set_sdfs(sdmmc_->fs());
   }
@@ -24,13 +29,40 @@ void AclComponent::setup() {
   server_.set_path(path_);
   server_.set_store(&store_);
   server_.set_reload([this]() -> void {
-    this->reload_acl();
+    // runs on the http server task
+    this->upload_pending_ = true;
+  });
+  server_.set_resolver([this](uint32_t key_hash, std::string &out) -> bool {
+    // runs on the http server task
+    AclSnapshotRef acl = this->snapshot_();
+    auto res = acl->find_hash(key_hash);
+    if (res.has_value()) {
+      out.append(res->name);
+      out += ": ";
+      out.append(res->key);
+    }
+    return res.has_value();
+  });
+  epoch_ = random_uint32();
+  server_.set_version([this]() -> AclVersion {
+    return AclVersion{this->epoch_, this->generation_.load(), (time_t) this->modified_.load()};
+  });
+  server_.set_content([this]() -> AclContent {
+    // runs on a server worker task
+    return this->render_content_();
+  });
+  server_.set_changes(&changes_);
+  server_.set_patch([this](std::vector<AclChange> &&changes) -> void {
+    // runs on a server worker task
+    LockGuard guard(this->patch_lock_);
+    std::move(changes.begin(), changes.end(), std::back_inserter(this->patches_));
+    this->patch_pending_ = true;
   });
   reload_acl();
 }
 
 void AclComponent::start_server() {
-  server_.start(88);
+  server_.start(88, max_open_sockets_);
 }
 
 void AclComponent::loop() {
@@ -40,89 +72,232 @@ void AclComponent::loop() {
     start_server();
   }
  
+  release_retired_();
+  server_.flush_events();
+
+  if (upload_pending_.exchange(false)) {
+    reload_acl();
+  }
+  // logs have files of their own and keep going while the list is loaded or stored, a short step each loop;
+  // flush once the buffer is half full or the oldest record waited long enough, after a failed flush only the latter
+  size_t pending = logs_.size();
+  bool full = !log_store_failed_ && pending * 2 >= logs_.capacity();
+  if (pending > 0 && (full || millis() - last_log_flush_ >= log_flush_interval_)) {
+    store_logs_();
+  } else {
+    maintain_logs_();
+  }
+
+  // a load in progress would replace changes applied meanwhile, they wait for it
+  if (store_.loading()) {
+    load_step_();
+    return;
+  }
+  // applied after a pending reload, which would otherwise replace them; a merge replays them onto the merged
+  // list and a store keeps them in the journal
+  if (!reload_required_ && patch_pending_.exchange(false)) {
+    apply_patches_();
+    return;
+  }
+  if (merge_ || store_.storing()) {
+    store_step_();
+    return;
+  }
   if (store_required_) {
     store_required_ = false;
     store_acl_();
-    load_acl_();
     return;
   }
   if (reload_required_) {
     reload_required_ = false;
-    if (!load_acl_()) {
-      // try again later
-      if (++reload_retries_ < MAX_RELOAD_RETRIES) {
-        set_timeout(5000, [this]() -> void {
-          ESP_LOGI(TAG, "[%s] Retrying reload", path_.c_str());
-          reload_required_ = true;
-        });
-      }
-    }
-    return;
-  }
-  if (!pending_logs_.empty()) {
-    store_logs_();
-    pending_logs_.clear();
-    return;
+    load_acl_();
   }
 }
 
-optional<AclEntry*> AclComponent::check(const std::string &key) {
-  auto res = acl_.find(key);
-  if (res == acl_.end()) {
-    ESP_LOGD(TAG, "[%s] ACL <UNAUTHORIZED>: %s", path_.c_str(), key.c_str());
-    append_log(string_format("<UNAUTHORIZED>: %s", key.c_str()));
+AclRecordRef AclComponent::check(std::string_view key) {
+  // the reference keeps the snapshot alive through logging and for as long as the caller holds the record;
+  // nothing here allocates, the result is logged as raw fields and only formatted when the buffer is flushed
+  AclSnapshotRef acl = snapshot_();
+  optional<AclRecord> res = acl->find(key);
+  if (!res.has_value()) {
+    ESP_LOGD(TAG, "[%s] ACL <UNAUTHORIZED>: %.*s", path_.c_str(), (int) key.size(), key.data());
+    uint32_t timestamp = timestamp_();
+    logs_.push(timestamp, LOG_DENIED, "", key);
+    server_.push_event(timestamp, LOG_DENIED, "", key);
     return {};
   }
-  ESP_LOGD(TAG, "[%s] ACL %s: %s", path_.c_str(), res->second.name.c_str(), key.c_str());
-  append_log(string_format("%s: %s", res->second.name.c_str(), key.c_str()));
-  return &res->second;
+  ESP_LOGD(TAG, "[%s] ACL %s: %.*s", path_.c_str(), res->name.data(), (int) key.size(), key.data());
+  uint32_t timestamp = timestamp_();
+  logs_.push(timestamp, LOG_GRANTED, res->name, key);
+  server_.push_event(timestamp, LOG_GRANTED, res->name, key);
+  return AclRecordRef(std::move(acl), res.value());
 }
 
 void AclComponent::append_log(const std::string &message) {
-  LogEntry log(timestamp_(), std::move(message));
-  pending_logs_.insert(pending_logs_.end(), std::move(log));
+  uint32_t timestamp = timestamp_();
+  logs_.push(timestamp, LOG_MESSAGE, message);
+  server_.push_event(timestamp, LOG_MESSAGE, message);
 }
 
 void AclComponent::add_acl(const std::string &name, const std::string &key) {
-  AclEntry entry(name, key);
-  acl_.emplace(key, std::move(entry));
-  ESP_LOGI(TAG, "[%s] ACL added name=%s, key=%s", path_.c_str(), name.c_str(), key.c_str());
-  store_acl_();
-  reload_acl();
+  if (!AclStore::is_valid_entry(name, key)) {
+    ESP_LOGW(TAG, "[%s] ACL entry rejected name=%s, key=%s", path_.c_str(), name.c_str(), key.c_str());
+    return;
+  }
+  batch_.push_back(AclChange{0, true, name, key});
+  if (batch_depth_ == 0) {
+    apply_batch_();
+  }
 }
 
 void AclComponent::remove_acl(const std::string &name) {
-  for(auto it = acl_.begin(); it != acl_.end();) {
-    if(it->second.name == name) {
-      ESP_LOGI(TAG, "[%s] ACL removed name=%s, key=%s", path_.c_str(), it->second.name.c_str(), it->second.key.c_str());
-      it = acl_.erase(it);
-      store_acl_();
-      reload_acl();
-    } else {
-      ++it;
-    }
+  // the keys are looked up when the change is applied, after the adds before it
+  batch_.push_back(AclChange{0, false, name, ""});
+  if (batch_depth_ == 0) {
+    apply_batch_();
+  }
+}
+
+std::vector<std::string> AclComponent::get_keys(const std::string &name) {
+  AclSnapshotRef acl = snapshot_();
+  return keys_of_(acl.get(), name);
+}
+
+std::vector<std::string> AclComponent::keys_of_(const AclSnapshot *acl, const std::string &name) {
+  std::vector<std::string> keys;
+  acl->for_each_of(name, [&keys](const AclRecord &record) -> void {
+    keys.emplace_back(record.key);
+  });
+  return keys;
+}
+
+void AclComponent::begin_batch() {
+  batch_depth_++;
+}
+
+void AclComponent::commit() {
+  if (batch_depth_ == 0) {
+    ESP_LOGW(TAG, "[%s] ACL commit without begin_batch", path_.c_str());
+    return;
+  }
+  if (--batch_depth_ == 0) {
+    apply_batch_();
   }
 }
 
 void AclComponent::clear_acl() {
-  if (!acl_.empty()) {
-    acl_.clear();
+  if (batch_depth_ > 0) {
+    // changes collected so far are void, the rest is applied to an empty list on commit()
+    batch_.clear();
+    batch_clear_ = true;
+    return;
+  }
+  // the list is still empty before and while the first load runs, which would bring back what is cleared;
+  // it is cancelled and the list on the card is rewritten first
+  if (!acl_.load()->empty() || reload_required_ || store_.loading() || merge_ || store_.storing()) {
+    cancel_io_();
+    changes_.reset(generation_ + 1);
+    publish_(new AclSnapshot());
     ESP_LOGI(TAG, "[%s] ACL cleared", path_.c_str());
-    store_acl_();
-    reload_acl();
+    store_required_ = true;
+  }
+}
+
+void AclComponent::journal_(bool appended) {
+  // a failed append or a long journal is settled by rewriting acl.csv from the table, a store in progress
+  // settles the latter and checks again when it is done
+  if (!appended || (store_.compaction_required() && !merge_ && !store_.storing())) {
+    store_required_ = true;
+  }
+}
+
+void AclComponent::apply_patches_() {
+  std::vector<AclChange> changes;
+  {
+    LockGuard guard(patch_lock_);
+    changes.swap(patches_);
+  }
+  apply_changes_(changes, false);
+}
+
+void AclComponent::apply_batch_() {
+  std::vector<AclChange> changes;
+  changes.swap(batch_);
+  bool clear = batch_clear_;
+  batch_clear_ = false;
+  apply_changes_(changes, clear);
+}
+
+void AclComponent::apply_changes_(std::vector<AclChange> &changes, bool clear, bool journal) {
+  // all changes become visible at once, under a single generation, and are recorded before they
+  // are published, so no client syncing meanwhile can miss one; they go into a single copy of the overlay
+  uint32_t generation = generation_ + 1;
+  std::unique_ptr<AclSnapshot> acl;
+  if (clear) {
+    acl.reset(new AclSnapshot());
+    changes_.reset(generation);
+    ESP_LOGI(TAG, "[%s] ACL cleared", path_.c_str());
+  }
+  std::vector<AclChange> applied;
+  auto edit = [this, &acl]() -> AclSnapshot * {
+    if (!acl) {
+      acl.reset(acl_.load()->copy());
+    }
+    return acl.get();
+  };
+  auto erase = [this, &edit, &applied, generation](const std::string &name, const std::string &key) -> void {
+    edit()->erase(key);
+    changes_.record(generation, false, name, key);
+    applied.push_back(AclChange{generation, false, name, key});
+    ESP_LOGD(TAG, "[%s] ACL removed name=%s, key=%s", path_.c_str(), name.c_str(), key.c_str());
+  };
+  for (auto &change: changes) {
+    const AclSnapshot *current = acl ? acl.get() : acl_.load();
+    if (change.add) {
+      edit()->insert(change.name, change.key);
+      changes_.record(generation, true, change.name, change.key);
+      ESP_LOGD(TAG, "[%s] ACL added name=%s, key=%s", path_.c_str(), change.name.c_str(), change.key.c_str());
+      applied.push_back(std::move(change));
+    } else if (!change.key.empty()) {
+      auto record = current->find(change.key);
+      if (record.has_value()) {
+        erase(std::string(record->name), change.key);
+      }
+    } else {
+      // removed by name, every key of it
+      std::vector<std::string> keys = keys_of_(current, change.name);
+      for (auto const& key: keys) {
+        erase(change.name, key);
+      }
+    }
+  }
+  if (!acl) {
+    return;
+  }
+  publish_(acl.release());
+  if (!applied.empty()) {
+    ESP_LOGI(TAG, "[%s] ACL updated with %u changes", path_.c_str(), (unsigned) applied.size());
+  }
+  if (clear) {
+    // acl.csv is rewritten as a whole, which covers the changes as well
+    cancel_io_();
+    store_required_ = true;
+  } else if (journal) {
+    journal_(store_.journal_changes(applied));
   }
 }
 
 void AclComponent::print_acl() {
-  if (acl_.empty()) {
+  const AclSnapshot *acl = acl_.load();
+  if (acl->empty()) {
     ESP_LOGI(TAG, "[%s] ACL list empty", path_.c_str());  
     return;
   }
   ESP_LOGI(TAG, "[%s] ACL list:", path_.c_str());
   uint16_t i = 0;
-  for (auto const& entry: acl_) {
-    ESP_LOGI(TAG, "%d: name=%s, key=%s", ++i, entry.second.name.c_str(), entry.first.c_str());
-  }
+  acl->for_each([&i](const AclRecord &record) -> void {
+    ESP_LOGI(TAG, "%d: name=%s, key=%s", ++i, record.name.data(), record.key.data());
+  });
 }
 
 void AclComponent::reload_acl() {
@@ -130,38 +305,246 @@ void AclComponent::reload_acl() {
   reload_retries_ = 0;
 }
 
-bool AclComponent::load_acl_() {
-  auto acl_data = store_.load_acl();
-  if (!acl_data.has_value()) {
+void AclComponent::load_acl_() {
+  store_.reload_begin();
+  load_step_();
+}
+
+void AclComponent::load_step_() {
+  // the new table is built aside over several loops, check() keeps using the current one until it is published
+  AclTable table;
+  uint32_t start = millis();
+  LoadStatus status;
+  do {
+    status = store_.load_step(table);
+  } while (status == LOAD_PENDING && millis() - start < LOAD_STEP_TIME);
+  if (status == LOAD_PENDING) {
+    return;
+  }
+  if (status == LOAD_UNCHANGED) {
+    ESP_LOGD(TAG, "[%s] acl.csv unchanged, reload skipped", path_.c_str());
+    reload_changes_ = 0;
+    return;
+  }
+  if (status == LOAD_FAILED) {
     ESP_LOGW(TAG, "[%s] Unable to load ACL from acl.csv", path_.c_str());
-    return false;
+    // try again later
+    if (++reload_retries_ < MAX_RELOAD_RETRIES) {
+      set_timeout(5000, [this]() -> void {
+        ESP_LOGI(TAG, "[%s] Retrying reload", path_.c_str());
+        reload_required_ = true;
+      });
+    }
+    return;
   }
+  publish_loaded_(std::move(table));
+}
 
-  ESP_LOGI(TAG, "[%s] Reloaded ACL from acl.csv with %d entries", path_.c_str(), acl_data.value().size());
-  acl_.clear();
-  for (auto const& entry: acl_data.value()) {
-    acl_.emplace(entry.key, entry);
+void AclComponent::publish_loaded_(AclTable &&table) {
+  const AclSnapshot *current = acl_.load();
+  std::vector<AclChange> changes;
+  reload_changes_ = diff_(current, table, changes);
+  ESP_LOGI(TAG, "[%s] Reloaded ACL from acl.csv with %u entries, %u changed", path_.c_str(), (unsigned) table.size(),
+           (unsigned) reload_changes_);
+  if (reload_changes_ == 0) {
+    journal_(true);
+    return;
   }
-  return true;
+  if (!current->empty() && current->overlay_size() + reload_changes_ <= MAX_ACL_CHANGES) {
+    // a few changes go on top of the current list like a patch, acl.csv and the journal already hold them
+    apply_changes_(changes, false, false);
+  } else {
+    uint32_t generation = generation_ + 1;
+    if (!current->empty() && reload_changes_ <= MAX_ACL_CHANGES) {
+      for (auto const& change: changes) {
+        changes_.record(generation, change.add, change.name, change.key);
+      }
+    } else {
+      changes_.reset(generation);
+    }
+    size_t size = table.size();
+    publish_(new AclSnapshot(std::make_shared<const AclTable>(std::move(table)), nullptr, size));
+  }
+  journal_(true);
+}
+
+size_t AclComponent::diff_(const AclSnapshot *current, const AclTable &table, std::vector<AclChange> &changes) {
+  // all differences are counted, but no more are kept than a patch or the change log would take
+  size_t changed = 0;
+  auto change = [&changes, &changed](bool add, const AclRecord &record) -> void {
+    if (++changed <= MAX_ACL_CHANGES) {
+      changes.push_back(AclChange{0, add, std::string(record.name), std::string(record.key)});
+    }
+  };
+  table.for_each([current, &change](const AclRecord &record) -> void {
+    optional<AclRecord> res = current->find(record.key);
+    if (!res.has_value() || res->name != record.name) {
+      change(true, record);
+    }
+  });
+  current->for_each([&table, &change](const AclRecord &record) -> void {
+    if (!table.find(record.key).has_value()) {
+      change(false, record);
+    }
+  });
+  return changed;
 }
 
 void AclComponent::store_acl_() {
-  std::list<AclEntry> to_store;
-  for (auto const& pair: acl_) {
-    to_store.insert(to_store.end(), pair.second);
+  AclSnapshotRef acl = snapshot_();
+  if (acl->overlay_size() == 0) {
+    store_.store_begin(acl->base(), store_.journal_size());
+  } else {
+    auto table = std::make_shared<AclTable>();
+    table->reserve(acl->size(), acl->base()->pool_size());
+    merge_.reset(new AclMerge{acl, generation_, store_.journal_size(), std::move(table)});
+  }
+  store_step_();
+}
+
+void AclComponent::store_step_() {
+  // like a load, the merge and the store run over several loops while check() keeps using the current list
+  uint32_t start = millis();
+  if (merge_) {
+    bool merging;
+    do {
+      merging = merge_->acl->merge_into(*merge_->table, merge_->cursor, MERGE_STEP_SIZE);
+    } while (merging && millis() - start < LOAD_STEP_TIME);
+    if (merging || !publish_merged_()) {
+      return;
+    }
+  }
+  LoadStatus status;
+  do {
+    status = store_.store_step();
+  } while (status == LOAD_PENDING && millis() - start < LOAD_STEP_TIME);
+  if (status == LOAD_PENDING) {
+    return;
+  }
+  if (status == LOAD_DONE) {
+    ESP_LOGD(TAG, "[%s] Stored ACL to acl.csv", path_.c_str());
   }
-  store_.store_acl(to_store);
+  // acl.csv was rewritten, so copies fetched before are outdated even if the list is not
+  touch_();
+  // changes journaled meanwhile may call for the next store
+  journal_(true);
+}
+
+bool AclComponent::publish_merged_() {
+  std::unique_ptr<AclMerge> merge = std::move(merge_);
+  std::vector<AclChange> changes;
+  bool known = changes_.since(merge->generation, [&changes](const AclChange &change) -> void {
+    changes.push_back(change);
+  });
+  if (!known) {
+    // too many changes meanwhile to replay, merged again from the list as it is now
+    store_required_ = true;
+    return false;
+  }
+  // the changes made meanwhile go on top again, so the published list is the current one
+  size_t size = merge->table->size();
+  std::unique_ptr<AclSnapshot> acl(new AclSnapshot(merge->table, nullptr, size));
+  for (auto const& change: changes) {
+    if (change.add) {
+      acl->insert(change.name, change.key);
+    } else {
+      acl->erase(change.key);
+    }
+  }
+  publish_(acl.release());
+  store_.store_begin(std::move(merge->table), merge->journal_size);
+  return true;
+}
+
+void AclComponent::cancel_io_() {
+  store_.load_cancel();
+  store_.store_cancel();
+  merge_.reset();
+}
+
+AclContent AclComponent::render_content_() {
+  // the version is taken before the snapshot, a copy sent while a change is published is tagged
+  // as the older version and fetched again
+  AclVersion version{epoch_, generation_.load(), (time_t) modified_.load()};
+  return AclContent{version, snapshot_()};
+}
+
+void AclComponent::publish_(const AclSnapshot *acl) {
+  const AclSnapshot *old = acl_.exchange(acl);
+  retired_.push_back(old);
+  touch_();
+}
+
+AclSnapshotRef AclComponent::snapshot_() {
+  // readers_ only covers the moment between loading the pointer and taking the reference
+  readers_++;
+  AclSnapshotRef acl(acl_.load());
+  readers_--;
+  return acl;
+}
+
+void AclComponent::touch_() {
+  // bumped after the change, so a copy served while it was made is never tagged as current
+  modified_ = timestamp_();
+  generation_++;
+}
+
+void AclComponent::release_retired_() {
+  if (retired_.empty() || readers_ > 0) {
+    return;
+  }
+  // readers_ was zero after the swap, so nobody is about to take a reference on a retired snapshot;
+  // those still referenced are kept until their last reference is dropped
+  retired_.erase(std::remove_if(retired_.begin(), retired_.end(), [](const AclSnapshot *acl) -> bool {
+    if (acl->referenced()) {
+      return false;
+    }
+    delete acl;
+    return true;
+  }), retired_.end());
 }
 
 void AclComponent::store_logs_() {
-  store_.store_logs(pending_logs_);
+  last_log_flush_ = millis();
+  log_store_failed_ = false;
+  logs_.drain([this](const LogRecord *records, size_t count) -> size_t {
+    size_t stored = store_.store_logs(records, count);
+    if (stored < count) {
+      // kept in the buffer and stored with the next flush
+      ESP_LOGW(TAG, "[%s] Storing logs failed, %u records kept", path_.c_str(), (unsigned) (count - stored));
+      log_store_failed_ = true;
+    }
+    return stored;
+  });
+  uint32_t dropped = logs_.take_dropped();
+  if (dropped > 0) {
+    ESP_LOGW(TAG, "[%s] Log buffer full, %u records dropped", path_.c_str(), dropped);
+    append_log(string_format("<DROPPED>: %u records", dropped));
+  }
+}
+
+void AclComponent::maintain_logs_() {
+  if (!log_maintenance_) {
+    // only started with an empty buffer, so no record of a past day is still waiting to be stored
+    uint32_t now = millis();
+    if (logs_.size() > 0 || (last_log_maintenance_.has_value() && now - last_log_maintenance_.value() < LOG_MAINTENANCE_INTERVAL)) {
+      return;
+    }
+    // days are only aged once the clock is set
+    if (timestamp_() < MIN_VALID_TIME) {
+      return;
+    }
+    last_log_maintenance_ = now;
+  }
+  // a single short step per loop, the card is shared with check() logging and the server
+  log_maintenance_ = store_.maintain_logs(timestamp_());
 }
 
-std::string AclComponent::timestamp_() {
+uint32_t AclComponent::timestamp_() {
   if (clock_ == nullptr) {
-    return ("" + millis());
+    return millis() / 1000;
   }
-  return clock_->now().strftime("%Y-%m-%d %H:%M:%S");
+  return clock_->now().timestamp;
 }
 
 /*
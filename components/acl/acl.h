@@ -2,8 +2,9 @@
 
 #include "acl_store.h"
 #include "acl_server.h"
+#include "acl_snapshot.h"
 
-#include <map>
+#include <atomic>
 
 #include "esphome/core/defines.h"
 #include "esphome/core/component.h"
@@ -17,19 +18,44 @@ namespace esphome {
 namespace acl {
 
 static const uint16_t MAX_RELOAD_RETRIES = 3;
+/// Time a loop() spends on loading or storing the list before it yields to other components.
+static const uint32_t LOAD_STEP_TIME = 10;
+/// Slots of the list copied per step of merging its overlay before a store.
+static const size_t MERGE_STEP_SIZE = 256;
+/// How often log retention and compression of past days run.
+static const uint32_t LOG_MAINTENANCE_INTERVAL = 3600 * 1000;
 
 class AclComponent : public Component /*, public AsyncWebHandler*/ {
   public:
     void set_clock(time::RealTimeClock *clock) { clock_ = clock; }
     void set_sdmmc(sdmmc::SdMmcComponent *sdmmc) { sdmmc_ = sdmmc; }
     void set_path(const std::string &path) { path_ = path; }
+    void set_log_buffer_size(uint16_t size) { log_buffer_size_ = size; }
+    void set_log_flush_interval(uint32_t interval) { log_flush_interval_ = interval; }
+    void set_log_format(LogFormat format) { log_format_ = format; }
+    void set_log_max_age(uint16_t days) { log_max_age_ = days; }
+    void set_log_max_size(uint32_t size) { log_max_size_ = size; }
+    void set_log_compress(bool compress) { log_compress_ = compress; }
+    void set_max_open_sockets(uint8_t sockets) { max_open_sockets_ = sockets; }
 
     void dump_config() override;
     void setup() override;
     void loop() override;
     void start_server();
 
-    optional<AclEntry*> check(const std::string &key);
+    /// Safe to call from any task and does not allocate, the access is logged and sent to event streams through
+    /// preallocated buffers that loop() empties. The returned record points into the current snapshot, which is
+    /// kept alive for as long as the record is held.
+    AclRecordRef check(std::string_view key);
+
+    /// Keys of a person, found through the name index. Safe to call from any task.
+    std::vector<std::string> get_keys(const std::string &name);
+
+    /// Changes below must be made from the main loop.
+    /// Changes made between begin_batch() and commit() are published as a single snapshot and written
+    /// to acl.journal at once. Batches may nest, the outermost commit() applies them.
+    void begin_batch();
+    void commit();
 
     void add_acl(
       const std::string &name,
@@ -42,9 +68,14 @@ class AclComponent : public Component /*, public AsyncWebHandler*/ {
     void print_acl();
 
     void reload_acl();
+    /// Entries added, renamed or removed by the last reload, 0 if acl.csv was unchanged.
+    size_t reload_changes() const { return reload_changes_; }
     
     void append_log(const std::string &message);
 
+    /// Log records lost because the buffer was full when they were made.
+    uint32_t dropped_logs() const { return logs_.dropped(); }
+
     /*
     void set_webserver(web_server_base::WebServerBase *webserver) { webserver_ = webserver; }
     bool canHandle(AsyncWebServerRequest *request) override;
@@ -59,17 +90,72 @@ class AclComponent : public Component /*, public AsyncWebHandler*/ {
 
     AclStore store_;
     AclServer server_;
-    std::map<std::string, AclEntry> acl_;
+    std::atomic<const AclSnapshot*> acl_{new AclSnapshot()};
+    std::atomic<uint16_t> readers_{0};
+    uint32_t epoch_{0};
+    std::atomic<uint32_t> generation_{0};
+    std::atomic<uint32_t> modified_{0};
+    AclChangeLog changes_;
+    Mutex patch_lock_;
+    std::vector<AclChange> patches_;
+    std::atomic<bool> patch_pending_{false};
+    std::vector<AclChange> batch_;
+    uint16_t batch_depth_{0};
+    bool batch_clear_{false};
+    /// Replaced snapshots, freed by the main loop once nobody references them.
+    std::vector<const AclSnapshot*> retired_;
     bool server_started_{false};
+    uint8_t max_open_sockets_{DEFAULT_MAX_OPEN_SOCKETS};
     bool store_required_{false};
     bool reload_required_{false};
+    std::atomic<bool> upload_pending_{false};
     uint16_t reload_retries_{0};
-    std::vector<LogEntry> pending_logs_;
-
-    bool load_acl_();
+    size_t reload_changes_{0};
+    AclLogBuffer logs_;
+    uint16_t log_buffer_size_{64};
+    uint32_t log_flush_interval_{5000};
+    LogFormat log_format_{LOG_FORMAT_TEXT};
+    uint32_t last_log_flush_{0};
+    /// The last flush left records in the buffer, they are retried once the flush interval has passed.
+    bool log_store_failed_{false};
+    uint16_t log_max_age_{0};
+    uint32_t log_max_size_{0};
+    bool log_compress_{true};
+    bool log_maintenance_{false};
+    optional<uint32_t> last_log_maintenance_;
+
+    /// A merge before a store: the list as of generation is copied into table a step at a time, then published
+    /// again with the changes made meanwhile and stored along with the journal after journal_size.
+    struct AclMerge {
+      AclSnapshotRef acl;
+      uint32_t generation;
+      size_t journal_size;
+      std::shared_ptr<AclTable> table;
+      size_t cursor{0};
+    };
+    std::unique_ptr<AclMerge> merge_;
+
+    void load_acl_();
+    void load_step_();
+    void publish_loaded_(AclTable &&table);
+    void publish_(const AclSnapshot *acl);
+    AclSnapshotRef snapshot_();
+    void touch_();
+    void release_retired_();
     void store_acl_();
+    void store_step_();
+    bool publish_merged_();
+    void cancel_io_();
+    void journal_(bool appended);
+    void apply_patches_();
+    void apply_batch_();
+    void apply_changes_(std::vector<AclChange> &changes, bool clear, bool journal = true);
+    static size_t diff_(const AclSnapshot *current, const AclTable &table, std::vector<AclChange> &changes);
+    static std::vector<std::string> keys_of_(const AclSnapshot *acl, const std::string &name);
+    AclContent render_content_();
     void store_logs_();
-    std::string timestamp_();
+    void maintain_logs_();
+    uint32_t timestamp_();
 
     /*
     web_server_base::WebServerBase *webserver_{nullptr};
@@ -77,5 +163,48 @@ class AclComponent : public Component /*, public AsyncWebHandler*/ {
     */
 };
 
+template<typename... Ts> class AclBeginBatchAction : public Action<Ts...> {
+  public:
+    AclBeginBatchAction(AclComponent *parent) : parent_(parent) {}
+
+    void play(Ts... x) override { this->parent_->begin_batch(); }
+
+  protected:
+    AclComponent *parent_;
+};
+
+template<typename... Ts> class AclCommitAction : public Action<Ts...> {
+  public:
+    AclCommitAction(AclComponent *parent) : parent_(parent) {}
+
+    void play(Ts... x) override { this->parent_->commit(); }
+
+  protected:
+    AclComponent *parent_;
+};
+
+template<typename... Ts> class AclAddAction : public Action<Ts...> {
+  public:
+    AclAddAction(AclComponent *parent) : parent_(parent) {}
+    TEMPLATABLE_VALUE(std::string, name)
+    TEMPLATABLE_VALUE(std::string, key)
+
+    void play(Ts... x) override { this->parent_->add_acl(this->name_.value(x...), this->key_.value(x...)); }
+
+  protected:
+    AclComponent *parent_;
+};
+
+template<typename... Ts> class AclRemoveAction : public Action<Ts...> {
+  public:
+    AclRemoveAction(AclComponent *parent) : parent_(parent) {}
+    TEMPLATABLE_VALUE(std::string, name)
+
+    void play(Ts... x) override { this->parent_->remove_acl(this->name_.value(x...)); }
+
+  protected:
+    AclComponent *parent_;
+};
+
 }  // namespace acl
 }  // namespace esphome
@@ -0,0 +1,35 @@
+#include "acl_changes.h"
+
+namespace esphome {
+namespace acl {
+
+void AclChangeLog::record(uint32_t generation, bool add, std::string_view name, std::string_view key) {
+  LockGuard guard(lock_);
+  if (changes_.size() >= MAX_ACL_CHANGES) {
+    floor_ = changes_.front().generation;
+    changes_.pop_front();
+  }
+  changes_.push_back(AclChange{generation, add, std::string(name), std::string(key)});
+}
+
+void AclChangeLog::reset(uint32_t generation) {
+  LockGuard guard(lock_);
+  changes_.clear();
+  floor_ = generation;
+}
+
+bool AclChangeLog::since(uint32_t generation, std::function<void(const AclChange&)> callback) {
+  LockGuard guard(lock_);
+  if (generation < floor_) {
+    return false;
+  }
+  for (auto const& change: changes_) {
+    if (change.generation > generation) {
+      callback(change);
+    }
+  }
+  return true;
+}
+
+}  // namespace acl
+}  // namespace esphome
@@ -0,0 +1,45 @@
+#pragma once
+
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <string>
+#include <string_view>
+
+#include "esphome/core/helpers.h"
+
+namespace esphome {
+namespace acl {
+
+/// Changes kept for clients catching up through acl/changes, older ones need the whole list.
+static const size_t MAX_ACL_CHANGES = 256;
+
+/// A single add or remove, as made by add_acl/remove_acl or an acl/patch request.
+struct AclChange {
+  uint32_t generation;
+  bool add;
+  std::string name;
+  std::string key;
+};
+
+/// Recent changes to the list by the generation that made them visible. Recorded by the main
+/// loop before the change is published, read by the server tasks.
+class AclChangeLog {
+  public:
+    void record(uint32_t generation, bool add, std::string_view name, std::string_view key);
+    /// Forgets all changes, used when the whole list was replaced. Clients have to fetch it again
+    /// unless they are at generation or later.
+    void reset(uint32_t generation);
+    /// Calls back with the changes made after generation, oldest first. Returns false without calling
+    /// back if some of them are no longer known. The lock is held, so the callback must not block.
+    bool since(uint32_t generation, std::function<void(const AclChange&)> callback);
+
+  protected:
+    Mutex lock_;
+    std::deque<AclChange> changes_;
+    /// Changes after this generation are all kept.
+    uint32_t floor_{0};
+};
+
+}  // namespace acl
+}  // namespace esphome
@@ -0,0 +1,86 @@
+#include "acl_log.h"
+
+#include <cstring>
+
+namespace esphome {
+namespace acl {
+
+/// Copies at most room characters of part, marking it as cut if it is longer. Returns the length copied.
+static size_t copy_part(std::string_view part, char *to, size_t room) {
+  if (part.length() <= room) {
+    part.copy(to, part.length());
+    return part.length();
+  }
+  size_t mark = std::min(room, sizeof LOG_TRUNCATED - 1);
+  part.copy(to, room - mark);
+  memcpy(to + room - mark, LOG_TRUNCATED, mark);
+  return room;
+}
+
+void AclLogBuffer::init(size_t capacity) {
+  records_.reset(new LogRecord[capacity]);
+  capacity_ = capacity;
+  head_ = 0;
+  count_ = 0;
+  text_capacity_ = std::max(capacity * LOG_TEXT_PER_RECORD, LOG_TEXT_LENGTH);
+  text_.reset(new char[text_capacity_]);
+  text_head_ = 0;
+  text_tail_ = 0;
+  text_used_ = 0;
+}
+
+size_t AclLogBuffer::size() {
+  LockGuard guard(lock_);
+  return count_;
+}
+
+char *AclLogBuffer::reserve_text_(size_t length) {
+  // the text of a record is kept in one piece, what does not fit before the end is skipped and counted as used
+  size_t offset = text_head_;
+  size_t skip = 0;
+  if (text_head_ >= text_tail_ && text_used_ < text_capacity_) {
+    if (text_head_ + length > text_capacity_) {
+      if (length > text_tail_) {
+        return nullptr;
+      }
+      offset = 0;
+      skip = text_capacity_ - text_head_;
+    }
+  } else if (text_head_ + length > text_tail_) {
+    return nullptr;
+  }
+  text_used_ += skip + length;
+  text_head_ = offset + length;
+  return text_.get() + offset;
+}
+
+bool AclLogBuffer::push(uint32_t timestamp, LogResult result, std::string_view first, std::string_view second) {
+  // the first part is cut first, then the second one
+  size_t first_len = std::min(first.length(), LOG_TEXT_LENGTH);
+  size_t second_len = std::min(second.length(), LOG_TEXT_LENGTH - first_len);
+  LockGuard guard(lock_);
+  char *text = count_ < capacity_ ? reserve_text_(first_len + second_len) : nullptr;
+  if (text == nullptr) {
+    dropped_++;
+    return false;
+  }
+  LogRecord &record = records_[head_];
+  record.timestamp = timestamp;
+  record.result = result;
+  record.name_length = copy_part(first, text, first_len);
+  record.key_length = copy_part(second, text + first_len, second_len);
+  record.text = text;
+  head_ = (head_ + 1) % capacity_;
+  count_++;
+  return true;
+}
+
+uint32_t AclLogBuffer::take_dropped() {
+  LockGuard guard(lock_);
+  uint32_t res = dropped_ - reported_dropped_;
+  reported_dropped_ = dropped_;
+  return res;
+}
+
+}  // namespace acl
+}  // namespace esphome
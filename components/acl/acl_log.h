@@ -0,0 +1,145 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <memory>
+#include <string_view>
+
+#include "line_reader.h"
+
+#include "esphome/core/helpers.h"
+
+namespace esphome {
+namespace acl {
+
+/// Longest text of a record, room for name and key of any entry is_valid_entry() accepts, so granted
+/// checks are logged in full.
+static const size_t LOG_TEXT_LENGTH = MAX_LINE_LENGTH;
+/// Text preallocated per record of a log buffer; names and keys are short, the odd long one borrows the
+/// room of others.
+static const size_t LOG_TEXT_PER_RECORD = 32;
+/// Ends a denied key or message cut to fit a record.
+static const char LOG_TRUNCATED[] = "...";
+
+enum LogResult : uint8_t {
+  LOG_GRANTED = 0,
+  LOG_DENIED = 1,
+  LOG_MESSAGE = 2,
+};
+
+enum LogFormat : uint8_t {
+  LOG_FORMAT_TEXT = 0,
+  LOG_FORMAT_BINARY = 1,
+};
+
+static const size_t LOG_HOURS = 24;
+static const uint32_t LOG_INDEX_UNSET = 0xFFFFFFFF;
+/// Control characters only, which never appear in the text of continuation records.
+static const uint32_t LOG_RECORD_MARK = 0x1C1D1E1F;
+
+/// Record of the binary log format, kept in logs/YYYY-MM-DD.bin. The text of an
+/// entry follows the record as extra raw records holding length bytes: "name: key"
+/// for granted checks, the key for denied ones and messages as they are. Granted
+/// records without text, written by earlier versions, only have the key hash and
+/// are resolved against the ACL when read. logs/YYYY-MM-DD.idx holds the record
+/// number each hour starts at. The mark tells records from continuation records
+/// when the file is read backwards.
+struct BinaryLogRecord {
+  uint32_t timestamp;
+  uint32_t key_hash;
+  uint8_t result;
+  uint8_t extra;
+  uint16_t length;
+  uint32_t mark;
+};
+
+/// Fixed size access log record. For check results text holds name and key back
+/// to back (name empty when denied), for free form messages just the message.
+/// Denied keys and messages longer than LOG_TEXT_LENGTH are cut and end in
+/// LOG_TRUNCATED. The text lives in the buffer the record came from.
+struct LogRecord {
+  uint32_t timestamp;
+  LogResult result;
+  uint16_t name_length;
+  uint16_t key_length;
+  const char *text;
+
+  std::string_view name() const { return std::string_view(text, name_length); }
+  std::string_view key() const { return std::string_view(text + name_length, key_length); }
+  std::string_view message() const { return name(); }
+};
+
+/// Preallocated ring of log records filled by check() on any task and drained by
+/// the main loop, with a second ring holding their text. When either is full, new
+/// records are counted as dropped instead.
+class AclLogBuffer {
+  public:
+    /// Holds capacity records and LOG_TEXT_PER_RECORD characters of text per record, at least one
+    /// record of LOG_TEXT_LENGTH.
+    void init(size_t capacity);
+    size_t capacity() const { return capacity_; }
+    size_t size();
+    uint32_t dropped() const { return dropped_; }
+
+    bool push(uint32_t timestamp, LogResult result, std::string_view first, std::string_view second = {});
+
+    /// Passes all buffered records to callback in at most two contiguous runs and frees the slots of those it
+    /// returns as taken. A run not taken in full ends the drain, the rest is passed again next time.
+    /// Producers keep appending meanwhile; only the main loop may drain.
+    template<typename F> size_t drain(F callback) {
+      size_t head, count;
+      {
+        LockGuard guard(lock_);
+        head = head_;
+        count = count_;
+      }
+      if (count == 0) {
+        return 0;
+      }
+      size_t tail = (head + capacity_ - count) % capacity_;
+      size_t first = std::min(count, capacity_ - tail);
+      size_t taken = callback(&records_[tail], first);
+      if (taken == first && first < count) {
+        taken += callback(&records_[0], count - first);
+      }
+      if (taken == 0) {
+        return 0;
+      }
+      LockGuard guard(lock_);
+      count_ -= taken;
+      if (count_ == 0) {
+        text_head_ = 0;
+        text_tail_ = 0;
+        text_used_ = 0;
+      } else {
+        // the text of the records left starts after the last one drained, gaps skipped at the end included
+        const LogRecord &last = records_[(tail + taken - 1) % capacity_];
+        size_t end = (last.text - text_.get() + last.name_length + last.key_length) % text_capacity_;
+        text_used_ -= (end + text_capacity_ - text_tail_) % text_capacity_;
+        text_tail_ = end;
+      }
+      return taken;
+    }
+
+    /// Returns the number of records dropped since the previous call.
+    uint32_t take_dropped();
+
+  protected:
+    std::unique_ptr<LogRecord[]> records_;
+    size_t capacity_{0};
+    size_t head_{0};
+    size_t count_{0};
+    std::unique_ptr<char[]> text_;
+    size_t text_capacity_{0};
+    size_t text_head_{0};
+    size_t text_tail_{0};
+    size_t text_used_{0};
+    uint32_t dropped_{0};
+    uint32_t reported_dropped_{0};
+    Mutex lock_;
+
+    char *reserve_text_(size_t length);
+};
+
+}  // namespace acl
+}  // namespace esphome
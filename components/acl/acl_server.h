@@ -1,13 +1,161 @@
 #pragma once
 
+#include <atomic>
+#include <ctime>
+#include <memory>
 #include <string>
+#include <vector>
+#include "acl_changes.h"
+#include "acl_snapshot.h"
 #include "acl_store.h"
+#include "gzip.h"
 
 #include <esp_http_server.h>
+#include <esp_idf_version.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/queue.h>
 
 namespace esphome {
 namespace acl {
 
+/// Rendered log lines are sent once this many bytes are pending.
+static const size_t CHUNK_SIZE = 1024;
+/// Uploads are received in pieces of this size.
+static const size_t RECEIVE_BUFFER_SIZE = 512;
+
+/// Last-Modified is only sent for times after this, earlier ones mean the clock was not set.
+static const time_t MIN_VALID_TIME = 1577836800;  // 2020-01-01
+
+/// Identifies the ACL currently in effect. The epoch changes on every boot, the generation on
+/// every change to the list or to acl.csv.
+struct AclVersion {
+  uint32_t epoch;
+  uint32_t generation;
+  time_t modified;
+};
+
+/// The list in effect, rendered as acl.csv line by line while it is sent. The reference keeps the
+/// snapshot alive until the request is done, so ranges of one copy always refer to the same bytes.
+struct AclContent {
+  AclVersion version;
+  AclSnapshotRef acl;
+};
+
+/// Largest acl/patch body, bigger changes are uploaded as a whole acl.csv.
+static const size_t MAX_PATCH_SIZE = 8192;
+
+/// Entries returned by logs/tail unless n is given, and the most it may ask for.
+static const size_t DEFAULT_TAIL_ENTRIES = 50;
+static const size_t MAX_TAIL_ENTRIES = 1000;
+/// Longest text log line a query reads.
+static const size_t LOG_LINE_LENGTH = 512;
+/// Longest period a single log query may cover.
+static const time_t MAX_QUERY_PERIOD = 31 * 24 * 3600;
+
+/// Filters of a logs/query request.
+struct LogQuery {
+  time_t from;
+  time_t to;
+  /// from and to as the "[YYYY-MM-DD HH:MM:SS]" prefix of text log lines.
+  char from_stamp[32];
+  char to_stamp[32];
+  std::string name;
+  optional<LogResult> result;
+  size_t limit;
+};
+
+/// Sockets of the shared server unless max_open_sockets is set. httpd takes three more lwIP sockets for itself,
+/// the rest stay free for the API, the web server and other components.
+static const size_t DEFAULT_MAX_OPEN_SOCKETS = 4;
+/// lwIP sockets httpd uses besides the ones of its clients.
+static const size_t HTTPD_INTERNAL_SOCKETS = 3;
+
+/// httpd_req_async_handler_begin() only exists since ESP-IDF 5.1, older versions serve every request
+/// on the server task.
+#if ESP_IDF_VERSION >= ESP_IDF_VERSION_VAL(5, 1, 0)
+#define ACL_ASYNC_WORKERS
+#endif
+
+/// Tasks that run requests reading or writing the card, so that a long download does not hold up
+/// the server task, and the requests that may wait for one of them.
+static const size_t ASYNC_WORKERS = 2;
+static const size_t ASYNC_QUEUE_SIZE = 4;
+static const uint32_t ASYNC_WORKER_STACK_SIZE = 6144;
+
+/// Event stream clients served at once; a new one replaces the oldest.
+static const size_t MAX_EVENT_CLIENTS = 2;
+/// Events queued per client. A client that falls this far behind is disconnected.
+static const size_t EVENT_QUEUE_SIZE = 16;
+
+class AclServer;
+
+/// The one httpd instance of the device, shared by all ACL instances. Requests are dispatched to
+/// the AclServer whose path is the first segment of the URL.
+class AclRouter {
+  public:
+    static AclRouter *get();
+
+    /// Adds a route for /<path>/ and starts the server on the first one, with at most max_sockets clients.
+    /// Returns the server handle.
+    httpd_handle_t attach(const std::string &path, AclServer *server, uint16_t port, size_t max_sockets);
+    /// The server stops once its last route is removed.
+    void detach(AclServer *server);
+
+    /// Hands a request over to a worker task and frees the server task for the next one. Serves it right
+    /// away where there are no workers.
+    esp_err_t defer(httpd_req_t *r, AclServer *server);
+
+  protected:
+    struct Route {
+      std::string prefix;
+      AclServer *server;
+    };
+    struct AsyncRequest {
+      httpd_req_t *req;
+      AclServer *server;
+    };
+
+    std::vector<Route> routes_;
+    Mutex lock_;
+    httpd_handle_t server_{};
+    uint16_t port_{0};
+    QueueHandle_t queue_{};
+
+    AclServer *find_(const char *uri);
+    void start_workers_();
+#ifdef ACL_ASYNC_WORKERS
+    static void worker_(void *arg);
+#endif
+    static esp_err_t handle_request_(httpd_req_t *r);
+};
+
+/// Body of a chunked response, gzip compressed on the fly if asked to.
+class ResponseWriter {
+  public:
+    ResponseWriter(httpd_req_t *r, bool gzip);
+
+    /// True if the gzip encoder could not be allocated; nothing has been sent then and the request can still
+    /// be answered otherwise.
+    bool out_of_memory() const { return gzip_ && gzip_->out_of_memory(); }
+    /// Both return false once the client went away.
+    bool write(const char *data, size_t length);
+    /// Sends what is still pending and ends the response.
+    bool finish();
+
+  protected:
+    httpd_req_t *r_;
+    std::unique_ptr<GzipEncoder> gzip_;
+    bool ok_{true};
+};
+
+/// A connected event stream. Its queue is filled by push_event() on any task and
+/// sent on the server task.
+struct EventClient {
+  AclServer *server;
+  int fd;
+  AclLogBuffer events;
+};
+
 class AclServer {
   public:
     ~AclServer() { this->stop(); }
@@ -15,25 +163,77 @@ class AclServer {
     void set_path(const std::string &path) { path_ = path; }
     void set_store(AclStore *store) { this->store_ = store; }
     void set_reload(std::function<void()> reload) { this->reload_ = reload; }
+    /// Appends "name: key" of the entry with the given key hash, used for binary logs written without names.
+    void set_resolver(std::function<bool(uint32_t, std::string&)> resolver) { this->resolver_ = resolver; }
+    void set_version(std::function<AclVersion()> version) { this->version_ = version; }
+    /// Provides the list served as acl.csv, so the card is not read and the copy matches what check() uses.
+    void set_content(std::function<AclContent()> content) { this->content_ = content; }
+    void set_changes(AclChangeLog *changes) { this->changes_ = changes; }
+    /// Receives the changes of an acl/patch request, to be applied by the main loop.
+    void set_patch(std::function<void(std::vector<AclChange>&&)> patch) { this->patch_ = patch; }
 
-    void start(uint16_t port);
+    void start(uint16_t port, size_t max_sockets = DEFAULT_MAX_OPEN_SOCKETS);
     void stop();
 
+    /// Queues an access event for the connected event streams. Safe to call from any task and does not
+    /// allocate, the events only go out once flush_events() runs.
+    void push_event(uint32_t timestamp, LogResult result, std::string_view first, std::string_view second = {});
+    /// Hands the events pushed since the last call to the server task, which sends them. Called from the main loop.
+    void flush_events();
+
   protected:
     std::string path_;
     AclStore *store_;
     std::function<void()> reload_;
+    std::function<bool(uint32_t, std::string&)> resolver_;
+    std::function<AclVersion()> version_;
+    std::function<AclContent()> content_;
+    AclChangeLog *changes_{nullptr};
+    std::function<void(std::vector<AclChange>&&)> patch_;
 
     httpd_handle_t server_{};
 
+    std::vector<std::unique_ptr<EventClient>> event_clients_;
+    std::atomic<size_t> event_client_count_{0};
+    std::atomic<bool> events_pending_{false};
+    std::atomic<bool> events_scheduled_{false};
+    Mutex event_lock_;
+
+    friend class AclRouter;
+
+    /// Requests that read or write the card are deferred to a worker unless already running on one.
+    esp_err_t handle_get(httpd_req_t *r, bool worker);
+    esp_err_t handle_post(httpd_req_t *r, bool worker);
     esp_err_t logs_get(httpd_req_t *r, const std::string &logfile);
+    esp_err_t logs_query(httpd_req_t *r);
+    esp_err_t logs_tail(httpd_req_t *r);
+    esp_err_t events_get(httpd_req_t *r);
     esp_err_t acl_get(httpd_req_t *r);
-    esp_err_t acl_post(httpd_req_t *r, std::string&& post_body);
+    esp_err_t acl_post(httpd_req_t *r);
+    esp_err_t acl_changes(httpd_req_t *r);
+    esp_err_t acl_patch(httpd_req_t *r);
+    void send_headers_(httpd_req_t *r, const std::string &etag, const std::string &last_modified,
+                       const std::string &content_range = "", bool gzip = false);
+    bool apply_range_(httpd_req_t *r, const std::string &etag, size_t size, size_t &offset, size_t &length);
+    static bool parse_range_(const std::string &range, size_t size, size_t &offset, size_t &length);
+    bool not_modified_(httpd_req_t *r, const std::string &etag, const std::string &last_modified);
+    static void acl_tags_(const AclVersion &version, bool gzip, std::string &etag, std::string &last_modified);
+    static std::string http_date_(time_t time);
+    static bool send_chunk_(ResponseWriter &out, std::string &chunk, size_t min_length = 1);
+    static bool accepts_gzip_(httpd_req_t *r);
+    static esp_err_t send_unavailable_(httpd_req_t *r);
+    static bool parse_log_query_(const std::string &query, LogQuery &res);
+    static LogResult classify_log_line_(std::string_view line);
+    static bool match_log_line_(const LogQuery &query, std::string_view line, LogResult result);
+    void send_events_();
+    void remove_event_client_(EventClient *client);
+    static void render_event_(const LogRecord &record, std::string &out);
+    void render_log_record_(const BinaryLogRecord &record, std::string_view text, std::string &out);
 
-    static esp_err_t handle_get(httpd_req_t *r);
-    static esp_err_t handle_post(httpd_req_t *r);
     static bool request_has_header(httpd_req_t *req, const char *name);
     static optional<std::string> request_get_header(httpd_req_t *req, const char *name);
+    static optional<std::string> request_get_query(httpd_req_t *req);
+    static optional<std::string> query_get_param(const std::string &query, const char *name);
 };
 
 }  // namespace acl
@@ -1,86 +1,235 @@
 #include "acl_server.h"
+#include "line_reader.h"
+#include "util.h"
 #include "esphome/core/log.h"
 
+#include <freertos/task.h>
+
+#include <algorithm>
+#include <cctype>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+
 namespace esphome {
 namespace acl {
 
 static const char *const TAG = "acl_serve";
 
-void AclServer::stop() {
-  if (this->server_) {
-    httpd_stop(this->server_);
-    this->server_ = nullptr;
-  }
+AclRouter *AclRouter::get() {
+  // never destroyed, servers may still detach while static objects are torn down
+  static AclRouter *router = new AclRouter();
+  return router;
 }
 
-void AclServer::start(uint16_t port) {
-  stop();
+httpd_handle_t AclRouter::attach(const std::string &path, AclServer *server, uint16_t port, size_t max_sockets) {
+  {
+    LockGuard guard(lock_);
+    routes_.erase(std::remove_if(routes_.begin(), routes_.end(), [server](const Route &route) -> bool {
+      return route.server == server;
+    }), routes_.end());
+    routes_.push_back(Route{"/" + path + "/", server});
+    // nested paths are matched before their parents
+    std::sort(routes_.begin(), routes_.end(), [](const Route &a, const Route &b) -> bool {
+      return a.prefix.length() > b.prefix.length();
+    });
+  }
+  ESP_LOGI(TAG, "Serving /%s/", path.c_str());
+  if (server_ != nullptr) {
+    if (port != port_) {
+      ESP_LOGW(TAG, "Server already runs on port %d, /%s/ is served there", port_, path.c_str());
+    }
+    return server_;
+  }
 
   httpd_config_t config = HTTPD_DEFAULT_CONFIG();
   config.server_port = port;
   config.ctrl_port = 16384;
-  config.max_open_sockets = 3;
+  // httpd refuses to start with more than lwIP has left
+  if (max_sockets + HTTPD_INTERNAL_SOCKETS > CONFIG_LWIP_MAX_SOCKETS) {
+    max_sockets = CONFIG_LWIP_MAX_SOCKETS - HTTPD_INTERNAL_SOCKETS;
+    ESP_LOGW(TAG, "Only %d sockets available, limiting the server to them", (int) max_sockets);
+  }
+  config.max_open_sockets = max_sockets;
+  // room for the card write buffer and the upload receive buffer
+  config.stack_size = 6144;
+  // the default of 8 is too few for the cache, range and encoding headers together
+  config.max_resp_headers = 12;
   config.uri_match_fn = [](const char * /*unused*/, const char * /*unused*/, size_t /*unused*/) { return true; };
+  // connections are kept open between requests, the least recently used one makes room for a new client
+  config.lru_purge_enable = true;
   ESP_LOGI(TAG, "Starting server on port %d", port);
 
-  if (httpd_start(&this->server_, &config) == ESP_OK) {
-    const httpd_uri_t get_handler = {
-        .uri = "",
-        .method = HTTP_GET,
-        .handler = AclServer::handle_get,
-        .user_ctx = this,
-    };
-    const httpd_uri_t post_handler = {
+  if (httpd_start(&this->server_, &config) != ESP_OK) {
+    this->server_ = nullptr;
+    return nullptr;
+  }
+  port_ = port;
+  for (httpd_method_t method: {HTTP_GET, HTTP_POST}) {
+    const httpd_uri_t handler = {
         .uri = "",
-        .method = HTTP_POST,
-        .handler = AclServer::handle_post,
+        .method = method,
+        .handler = AclRouter::handle_request_,
         .user_ctx = this,
     };
-    httpd_register_uri_handler(this->server_, &get_handler);
-    httpd_register_uri_handler(this->server_, &post_handler);
+    httpd_register_uri_handler(this->server_, &handler);
   }
+  start_workers_();
+  return server_;
 }
 
-esp_err_t AclServer::handle_get(httpd_req_t *r) {
-  std::string url = r->uri;
+void AclRouter::start_workers_() {
+#ifdef ACL_ASYNC_WORKERS
+  if (queue_ != nullptr) {
+    return;
+  }
+  queue_ = xQueueCreate(ASYNC_QUEUE_SIZE, sizeof(AsyncRequest));
+  if (queue_ == nullptr) {
+    return;
+  }
+  // the workers outlive a stopped server and pick up again once it restarts
+  for (size_t i = 0; i < ASYNC_WORKERS; i++) {
+    xTaskCreate(AclRouter::worker_, "acl_worker", ASYNC_WORKER_STACK_SIZE, this, tskIDLE_PRIORITY + 5, nullptr);
+  }
+#endif
+}
+
+#ifdef ACL_ASYNC_WORKERS
+void AclRouter::worker_(void *arg) {
+  AclRouter *router = static_cast<AclRouter *>(arg);
+  AsyncRequest request;
+  while (true) {
+    if (xQueueReceive(router->queue_, &request, portMAX_DELAY) != pdTRUE) {
+      continue;
+    }
+    if (request.req->method == HTTP_POST) {
+      request.server->handle_post(request.req, true);
+    } else {
+      request.server->handle_get(request.req, true);
+    }
+    httpd_req_async_handler_complete(request.req);
+  }
+}
+#endif
+
+esp_err_t AclRouter::defer(httpd_req_t *r, AclServer *server) {
+#ifdef ACL_ASYNC_WORKERS
+  httpd_req_t *copy = nullptr;
+  if (queue_ == nullptr || httpd_req_async_handler_begin(r, &copy) != ESP_OK) {
+    // without workers the request is served on the server task as before
+    return r->method == HTTP_POST ? server->handle_post(r, true) : server->handle_get(r, true);
+  }
+  AsyncRequest request{copy, server};
+  if (xQueueSend(queue_, &request, 0) != pdTRUE) {
+    httpd_resp_set_status(copy, "503 Service Unavailable");
+    httpd_resp_set_hdr(copy, "Retry-After", "1");
+    httpd_resp_send(copy, "Busy", HTTPD_RESP_USE_STRLEN);
+    httpd_req_async_handler_complete(copy);
+  }
+  return ESP_OK;
+#else
+  return r->method == HTTP_POST ? server->handle_post(r, true) : server->handle_get(r, true);
+#endif
+}
 
-  AclServer *server = static_cast<AclServer *>(r->user_ctx);
-  if (url == "/" + server->path_ + "/acl.csv") {
-    return server->acl_get(r);
-  } else if(url.compare(0, 7 + server->path_.length(), "/" + server->path_ + "/logs/") == 0 && url.compare(url.length() - 4, url.length(), ".log") == 0) {
-    std::string logfile = url.substr(7 + server->path_.length(), url.length() - 4 - 7 - server->path_.length());
-    return server->logs_get(r, logfile);
+void AclRouter::detach(AclServer *server) {
+  bool empty;
+  {
+    LockGuard guard(lock_);
+    routes_.erase(std::remove_if(routes_.begin(), routes_.end(), [server](const Route &route) -> bool {
+      return route.server == server;
+    }), routes_.end());
+    empty = routes_.empty();
+  }
+  if (empty && server_ != nullptr) {
+    // closes all sessions, which releases the event clients
+    httpd_stop(server_);
+    server_ = nullptr;
+  }
+}
+
+AclServer *AclRouter::find_(const char *uri) {
+  LockGuard guard(lock_);
+  for (auto const& route: routes_) {
+    if (strncmp(uri, route.prefix.c_str(), route.prefix.length()) == 0) {
+      return route.server;
+    }
+  }
+  return nullptr;
+}
+
+esp_err_t AclRouter::handle_request_(httpd_req_t *r) {
+  AclServer *server = static_cast<AclRouter *>(r->user_ctx)->find_(r->uri);
+  if (server != nullptr) {
+    return r->method == HTTP_POST ? server->handle_post(r, false) : server->handle_get(r, false);
   }
   httpd_resp_set_status(r, HTTPD_404);
   httpd_resp_send(r, "Not found", HTTPD_RESP_USE_STRLEN);
   return ESP_OK;
 }
 
-esp_err_t AclServer::handle_post(httpd_req_t *r) {
+void AclServer::stop() {
+  if (this->server_) {
+    {
+      LockGuard guard(event_lock_);
+      for (auto &client: event_clients_) {
+        httpd_sess_trigger_close(server_, client->fd);
+      }
+    }
+    AclRouter::get()->detach(this);
+    this->server_ = nullptr;
+  }
+}
+
+void AclServer::start(uint16_t port, size_t max_sockets) {
+  stop();
+  this->server_ = AclRouter::get()->attach(path_, this, port, max_sockets);
+}
+
+esp_err_t AclServer::handle_get(httpd_req_t *r, bool worker) {
   std::string url = r->uri;
-  std::string post_body;
-  if (r->content_len > 0) {
-    ESP_LOGI(TAG, "Receiving %d bytes", r->content_len);
-    post_body.resize(r->content_len);
-    int read = 0;
-    while (read < r->content_len) {
-      const int ret = httpd_req_recv(r, &post_body[read], r->content_len + 1 - read);
-      if (ret <= 0) {  // 0 return value indicates connection closed
-        if (ret == HTTPD_SOCK_ERR_TIMEOUT) {
-          httpd_resp_send_err(r, HTTPD_408_REQ_TIMEOUT, nullptr);
-          return ESP_ERR_TIMEOUT;
-        }
-        httpd_resp_send_err(r, HTTPD_400_BAD_REQUEST, nullptr);
-        return ESP_FAIL;
+  url = url.substr(0, url.find('?'));
+
+  if (url == "/" + path_ + "/acl.csv") {
+    if (!worker) {
+      // revalidations are answered from memory right away, only downloads go to a worker
+      std::string etag;
+      std::string last_modified;
+      if (version_) {
+        acl_tags_(version_(), accepts_gzip_(r) && !request_has_header(r, "Range"), etag, last_modified);
       }
-      read += ret;
+      return not_modified_(r, etag, last_modified) ? ESP_OK : AclRouter::get()->defer(r, this);
+    }
+    return acl_get(r);
+  } else if (url == "/" + path_ + "/acl/changes") {
+    return acl_changes(r);
+  } else if (url == "/" + path_ + "/logs/query") {
+    return worker ? logs_query(r) : AclRouter::get()->defer(r, this);
+  } else if (url == "/" + path_ + "/logs/tail") {
+    return worker ? logs_tail(r) : AclRouter::get()->defer(r, this);
+  } else if (url == "/" + path_ + "/events") {
+    // the event stream stays with the server task, which owns its socket
+    return events_get(r);
+  } else if(url.compare(0, 7 + path_.length(), "/" + path_ + "/logs/") == 0 && url.compare(url.length() - 4, url.length(), ".log") == 0) {
+    if (!worker) {
+      return AclRouter::get()->defer(r, this);
     }
+    std::string logfile = url.substr(7 + path_.length(), url.length() - 4 - 7 - path_.length());
+    return logs_get(r, logfile);
   }
-  ESP_LOGI(TAG, "Received %d bytes", post_body.length());
+  httpd_resp_set_status(r, HTTPD_404);
+  httpd_resp_send(r, "Not found", HTTPD_RESP_USE_STRLEN);
+  return ESP_OK;
+}
 
-  AclServer *server = static_cast<AclServer *>(r->user_ctx);
-  if (url == "/" + server->path_ + "/acl.csv") {
-    return server->acl_post(r, std::move(post_body));
+esp_err_t AclServer::handle_post(httpd_req_t *r, bool worker) {
+  std::string url = r->uri;
+
+  if (url == "/" + path_ + "/acl.csv") {
+    return worker ? acl_post(r) : AclRouter::get()->defer(r, this);
+  } else if (url == "/" + path_ + "/acl/patch") {
+    // the body may arrive slowly, even if it is small
+    return worker ? acl_patch(r) : AclRouter::get()->defer(r, this);
   }
   httpd_resp_set_status(r, HTTPD_404);
   httpd_resp_send(r, "Not found", HTTPD_RESP_USE_STRLEN);
@@ -88,52 +237,909 @@ esp_err_t AclServer::handle_post(httpd_req_t *r) {
 }
 
 esp_err_t AclServer::logs_get(httpd_req_t *r, const std::string &logfile) {
-  optional<std::string> res = store_->load_log_content(logfile);
-  if (!res.has_value()) {
+  optional<std::string> day = store_->resolve_log_day(logfile);
+  optional<sdmmc::FileInfo> info = day.has_value() ? store_->log_info(day.value()) : optional<sdmmc::FileInfo>{};
+  if (!info.has_value()) {
     httpd_resp_set_status(r, HTTPD_404);
     httpd_resp_send(r, "Not found", HTTPD_RESP_USE_STRLEN);
     return ESP_OK;
   }
-  httpd_resp_set_hdr(r, "Content-Type", "text/plain");
-  httpd_resp_set_hdr(r, "CDN-Cache-Control", "no-store");
-  httpd_resp_set_hdr(r, "Cache-Control", "no-cache");
-  httpd_resp_set_hdr(r, "Pragma", "no-cache");
-  httpd_resp_set_hdr(r, "Expires", "0");
-  httpd_resp_set_hdr(r, "Connection", "close");
-  httpd_resp_set_status(r, HTTPD_200);
-  httpd_resp_send(r, res.value().c_str(), HTTPD_RESP_USE_STRLEN);
+  // the day is part of the tag, latest.log moves on to a new file at midnight
+  // partial content is only served uncompressed, byte offsets refer to the file
+  bool gzip = accepts_gzip_(r) && !request_has_header(r, "Range");
+  std::string etag = string_format("\"%s-%x-%lx%s\"", day->c_str(), (unsigned) info->size, (long) info->mtime,
+                                   gzip ? "-gz" : "");
+  std::string last_modified = http_date_(info->mtime);
+  if (not_modified_(r, etag, last_modified)) {
+    return ESP_OK;
+  }
+  bool binary = store_->has_binary_log(day.value());
+  bool text = store_->has_text_log(day.value());
+  bool archived = text && store_->text_log_archived(day.value());
+
+  // ranges are served from uncompressed text logs only, rendered binary records have no fixed byte
+  // offsets and a Range header may be ignored
+  size_t offset = 0;
+  size_t length = SIZE_MAX;
+  std::string content_range;
+  if (!binary && !archived) {
+    length = info->size;
+    if (!apply_range_(r, etag, info->size, offset, length)) {
+      return ESP_OK;
+    }
+    if (length != info->size) {
+      content_range = string_format("bytes %u-%u/%u", (unsigned) offset, (unsigned) (offset + length - 1), (unsigned) info->size);
+    }
+  }
+
+  ResponseWriter out(r, gzip);
+  if (out.out_of_memory()) {
+    return send_unavailable_(r);
+  }
+  send_headers_(r, etag, last_modified, content_range, gzip);
+  bool sent = true;
+  if (gzip && archived && !binary) {
+    // a compressed day goes out as stored
+    ResponseWriter stored(r, false);
+    if (store_->read_text_log_archive(day.value(), [&stored, &sent](const char *data, const size_t length) -> bool {
+      sent = stored.write(data, length);
+      return sent;
+    })) {
+      return sent && stored.finish() ? ESP_OK : ESP_FAIL;
+    }
+  }
+  if (binary) {
+    std::string chunk;
+    chunk.reserve(CHUNK_SIZE + 128);
+    store_->read_binary_log(day.value(), 0, LOG_HOURS - 1,
+        [this, &out, &chunk, &sent](const BinaryLogRecord &record, std::string_view text) -> bool {
+      render_log_record_(record, text, chunk);
+      sent = send_chunk_(out, chunk, CHUNK_SIZE);
+      return sent;
+    });
+    sent = sent && send_chunk_(out, chunk);
+  }
+  if (sent && text) {
+    // a day can have both if the log format was changed that day
+    store_->read_text_log(day.value(), offset, length, [&out, &sent](const char *data, const size_t length) -> bool {
+      sent = out.write(data, length);
+      return sent;
+    });
+  }
+  if (!sent || !out.finish()) {
+    // client went away, the connection gets closed
+    return ESP_FAIL;
+  }
+  return ESP_OK;
+}
+
+esp_err_t AclServer::logs_query(httpd_req_t *r) {
+  LogQuery query;
+  if (!parse_log_query_(request_get_query(r).value_or(""), query)) {
+    httpd_resp_send_err(r, HTTPD_400_BAD_REQUEST, "Invalid query");
+    return ESP_OK;
+  }
+
+  bool gzip = accepts_gzip_(r);
+  ResponseWriter out(r, gzip);
+  if (out.out_of_memory()) {
+    return send_unavailable_(r);
+  }
+  send_headers_(r, "", "", "", gzip);
+  std::string chunk;
+  chunk.reserve(CHUNK_SIZE + MAX_LINE_LENGTH);
+  size_t count = 0;
+  bool sent = true;
+  // returns false once the limit is reached or the client went away
+  auto emit = [&out, &query, &chunk, &count, &sent](std::string_view line) -> bool {
+    chunk.append(line.data(), line.length());
+    chunk += "\r\n";
+    sent = send_chunk_(out, chunk, CHUNK_SIZE);
+    return sent && ++count < query.limit;
+  };
+
+  struct tm tm;
+  localtime_r(&query.from, &tm);
+  uint8_t from_hour = tm.tm_hour;
+  localtime_r(&query.to, &tm);
+  uint8_t to_hour = tm.tm_hour;
+  char to_day[16];
+  strftime(to_day, sizeof to_day, "%Y-%m-%d", &tm);
+
+  // days are stepped from noon, so that DST changes never skip or repeat one
+  localtime_r(&query.from, &tm);
+  tm.tm_hour = 12;
+  tm.tm_min = 0;
+  tm.tm_sec = 0;
+  bool more = true;
+  for (time_t noon = mktime(&tm), first = noon; more; noon += 24 * 3600) {
+    localtime_r(&noon, &tm);
+    char day[16];
+    strftime(day, sizeof day, "%Y-%m-%d", &tm);
+    bool last = strcmp(day, to_day) >= 0;
+    bool limited = false;
+    std::string line;
+    // the hour index skips straight to the first hour of the range
+    store_->read_binary_log(day, noon == first ? from_hour : 0, last ? to_hour : LOG_HOURS - 1,
+        [this, &query, &line, &emit, &limited](const BinaryLogRecord &record, std::string_view text) -> bool {
+      if (record.timestamp < query.from || record.timestamp > query.to ||
+          (query.result.has_value() && record.result != query.result.value()) ||
+          (!query.name.empty() && record.result != LOG_GRANTED)) {
+        return true;
+      }
+      line.clear();
+      render_log_record_(record, text, line);
+      line.resize(line.length() - 2);
+      if (match_log_line_(query, line, (LogResult) record.result)) {
+        limited = !emit(line);
+      }
+      return !limited;
+    });
+    if (!limited && store_->has_text_log(day)) {
+      LineReader reader([&query, &emit, &limited](std::string_view line) -> bool {
+        if (match_log_line_(query, line, classify_log_line_(line))) {
+          limited = !emit(line);
+        }
+        return !limited;
+      }, LOG_LINE_LENGTH);
+      store_->read_text_log(day, 0, SIZE_MAX, [&reader](const char *data, const size_t length) -> bool {
+        return reader.feed(data, length);
+      });
+      if (!limited) {
+        reader.finish();
+      }
+    }
+    more = !limited && !last;
+  }
+
+  if (!sent || !send_chunk_(out, chunk) || !out.finish()) {
+    return ESP_FAIL;
+  }
+  return ESP_OK;
+}
+
+esp_err_t AclServer::logs_tail(httpd_req_t *r) {
+  size_t count = DEFAULT_TAIL_ENTRIES;
+  optional<std::string> n = query_get_param(request_get_query(r).value_or(""), "n");
+  if (n.has_value()) {
+    char *end;
+    count = strtoul(n->c_str(), &end, 10);
+    if (n->empty() || *end != '\0' || count == 0 || count > MAX_TAIL_ENTRIES) {
+      httpd_resp_send_err(r, HTTPD_400_BAD_REQUEST, "Invalid n");
+      return ESP_OK;
+    }
+  }
+  optional<std::string> day = store_->resolve_log_day("latest");
+  if (!day.has_value()) {
+    httpd_resp_set_status(r, HTTPD_404);
+    httpd_resp_send(r, "Not found", HTTPD_RESP_USE_STRLEN);
+    return ESP_OK;
+  }
+
+  // a day with both formats is tailed in the one currently written
+  bool binary = store_->has_binary_log(day.value()) &&
+      (store_->log_format() == LOG_FORMAT_BINARY || !store_->has_text_log(day.value()));
+  bool gzip = accepts_gzip_(r);
+  ResponseWriter out(r, gzip);
+  if (out.out_of_memory()) {
+    return send_unavailable_(r);
+  }
+  send_headers_(r, "", "", "", gzip);
+  bool sent = true;
+  if (binary) {
+    std::string chunk;
+    chunk.reserve(CHUNK_SIZE + 128);
+    store_->read_binary_log_tail(day.value(), count, [this, &out, &chunk, &sent](const BinaryLogRecord &record, std::string_view text) -> bool {
+      render_log_record_(record, text, chunk);
+      sent = send_chunk_(out, chunk, CHUNK_SIZE);
+      return sent;
+    });
+    sent = sent && send_chunk_(out, chunk);
+  } else {
+    store_->read_text_log_tail(day.value(), count, [&out, &sent](const char *data, const size_t length) -> bool {
+      sent = out.write(data, length);
+      return sent;
+    });
+  }
+  if (!sent || !out.finish()) {
+    return ESP_FAIL;
+  }
   return ESP_OK;
 }
 
+bool AclServer::parse_log_query_(const std::string &query, LogQuery &res) {
+  // from and to are unix times, negative ones are relative to now
+  time_t now = ::time(nullptr);
+  auto parse_time = [now](const optional<std::string> &value, time_t fallback, time_t &out) -> bool {
+    if (!value.has_value()) {
+      out = fallback;
+      return true;
+    }
+    char *end;
+    long long parsed = strtoll(value->c_str(), &end, 10);
+    if (value->empty() || *end != '\0') {
+      return false;
+    }
+    out = parsed < 0 ? now + parsed : parsed;
+    return true;
+  };
+  if (!parse_time(query_get_param(query, "to"), now, res.to) ||
+      !parse_time(query_get_param(query, "from"), res.to - 24 * 3600, res.from) ||
+      res.from > res.to || res.to - res.from > MAX_QUERY_PERIOD) {
+    return false;
+  }
+  struct tm tm;
+  localtime_r(&res.from, &tm);
+  strftime(res.from_stamp, sizeof res.from_stamp, "[%Y-%m-%d %H:%M:%S]", &tm);
+  localtime_r(&res.to, &tm);
+  strftime(res.to_stamp, sizeof res.to_stamp, "[%Y-%m-%d %H:%M:%S]", &tm);
+
+  res.name = query_get_param(query, "name").value_or("");
+  optional<std::string> result = query_get_param(query, "result");
+  if (result.has_value()) {
+    if (result.value() == "granted") {
+      res.result = LOG_GRANTED;
+    } else if (result.value() == "denied") {
+      res.result = LOG_DENIED;
+    } else if (result.value() == "message") {
+      res.result = LOG_MESSAGE;
+    } else {
+      return false;
+    }
+  }
+
+  res.limit = SIZE_MAX;
+  optional<std::string> limit = query_get_param(query, "limit");
+  if (limit.has_value()) {
+    char *end;
+    res.limit = strtoul(limit->c_str(), &end, 10);
+    if (limit->empty() || *end != '\0' || res.limit == 0) {
+      return false;
+    }
+  }
+  return true;
+}
+
+LogResult AclServer::classify_log_line_(std::string_view line) {
+  // "[YYYY-MM-DD HH:MM:SS] " is followed by "name: key", "<UNAUTHORIZED>: key" or a message,
+  // which can't always be told apart from an entry
+  std::string_view rest = line.substr(std::min(line.length(), (size_t) 22));
+  if (rest.compare(0, 16, "<UNAUTHORIZED>: ") == 0) {
+    return LOG_DENIED;
+  }
+  if (!rest.empty() && rest[0] != '<' && rest.find(": ") != std::string_view::npos) {
+    return LOG_GRANTED;
+  }
+  return LOG_MESSAGE;
+}
+
+bool AclServer::match_log_line_(const LogQuery &query, std::string_view line, LogResult result) {
+  if (line.length() < 22 || line[0] != '[') {
+    return false;
+  }
+  if (query.result.has_value() && result != query.result.value()) {
+    return false;
+  }
+  // text lines only carry local time, which sorts as a string
+  std::string_view stamp = line.substr(0, 21);
+  if (stamp < query.from_stamp || stamp > query.to_stamp) {
+    return false;
+  }
+  if (!query.name.empty()) {
+    std::string_view rest = line.substr(22);
+    return result == LOG_GRANTED && rest.length() > query.name.length() + 1 &&
+        rest.compare(0, query.name.length(), query.name) == 0 && rest.compare(query.name.length(), 2, ": ") == 0;
+  }
+  return true;
+}
+
+void AclServer::render_log_record_(const BinaryLogRecord &record, std::string_view text, std::string &out) {
+  // same lines as the text log format
+  time_t timestamp = record.timestamp;
+  struct tm tm;
+  localtime_r(&timestamp, &tm);
+  char time[32];
+  strftime(time, sizeof time, "[%Y-%m-%d %H:%M:%S] ", &tm);
+  out += time;
+  switch (record.result) {
+    case LOG_GRANTED:
+      // records written before granted checks kept their name only have the key hash
+      if (!text.empty()) {
+        out.append(text.data(), text.length());
+      } else if (!resolver_ || !resolver_(record.key_hash, out)) {
+        char removed[24];
+        snprintf(removed, sizeof removed, "<REMOVED>: #%08x", (unsigned) record.key_hash);
+        out += removed;
+      }
+      break;
+    case LOG_DENIED:
+      out += "<UNAUTHORIZED>: ";
+      out.append(text.data(), text.length());
+      break;
+    default:
+      out.append(text.data(), text.length());
+      break;
+  }
+  out += "\r\n";
+}
+
+esp_err_t AclServer::events_get(httpd_req_t *r) {
+  // the session stays open after the handler returns, events are written to its socket directly
+  static const char *const HEADERS = "HTTP/1.1 200 OK\r\n"
+                                     "Content-Type: text/event-stream\r\n"
+                                     "Cache-Control: no-cache\r\n"
+                                     "Connection: keep-alive\r\n\r\n";
+  int fd = httpd_req_to_sockfd(r);
+  if (httpd_socket_send(server_, fd, HEADERS, strlen(HEADERS), 0) < 0) {
+    return ESP_FAIL;
+  }
+
+  auto client = std::make_unique<EventClient>();
+  client->server = this;
+  client->fd = fd;
+  client->events.init(EVENT_QUEUE_SIZE);
+  r->sess_ctx = client.get();
+  r->free_ctx = [](void *ctx) -> void {
+    EventClient *client = static_cast<EventClient *>(ctx);
+    client->server->remove_event_client_(client);
+  };
+  if (event_clients_.size() >= MAX_EVENT_CLIENTS) {
+    httpd_sess_trigger_close(server_, event_clients_.front()->fd);
+  }
+  ESP_LOGD(TAG, "Event stream opened on socket %d", fd);
+  LockGuard guard(event_lock_);
+  event_clients_.push_back(std::move(client));
+  event_client_count_ = event_clients_.size();
+  return ESP_OK;
+}
+
+void AclServer::push_event(uint32_t timestamp, LogResult result, std::string_view first, std::string_view second) {
+  if (event_client_count_ == 0 || server_ == nullptr) {
+    return;
+  }
+  {
+    LockGuard guard(event_lock_);
+    for (auto &client: event_clients_) {
+      client->events.push(timestamp, result, first, second);
+    }
+  }
+  events_pending_ = true;
+}
+
+void AclServer::flush_events() {
+  // queueing work sends a message to the server task through lwip, which allocates, so it is left to the main
+  // loop; events pushed meanwhile are sent by a send already queued
+  if (server_ == nullptr || !events_pending_.exchange(false) || events_scheduled_.exchange(true)) {
+    return;
+  }
+  httpd_queue_work(server_, [](void *arg) -> void {
+    static_cast<AclServer *>(arg)->send_events_();
+  }, this);
+}
+
+void AclServer::send_events_() {
+  // runs on the server task, which is the only one adding or removing clients
+  events_scheduled_ = false;
+  std::string data;
+  for (auto &client: event_clients_) {
+    data.clear();
+    client->events.drain([&data](const LogRecord *records, size_t count) -> size_t {
+      for (size_t i = 0; i < count; i++) {
+        render_event_(records[i], data);
+      }
+      return count;
+    });
+    if (client->events.take_dropped() > 0) {
+      ESP_LOGW(TAG, "Event stream on socket %d is too slow, closing", client->fd);
+      httpd_sess_trigger_close(server_, client->fd);
+      continue;
+    }
+    if (!data.empty() && httpd_socket_send(server_, client->fd, data.data(), data.length(), 0) < 0) {
+      httpd_sess_trigger_close(server_, client->fd);
+    }
+  }
+}
+
+void AclServer::remove_event_client_(EventClient *client) {
+  ESP_LOGD(TAG, "Event stream closed on socket %d", client->fd);
+  LockGuard guard(event_lock_);
+  for (auto it = event_clients_.begin(); it != event_clients_.end(); ++it) {
+    if (it->get() == client) {
+      event_clients_.erase(it);
+      break;
+    }
+  }
+  event_client_count_ = event_clients_.size();
+}
+
+void AclServer::render_event_(const LogRecord &record, std::string &out) {
+  // one server-sent event per record, its data is the line the text log would get
+  static const char *const EVENTS[] = {"granted", "denied", "message"};
+  time_t timestamp = record.timestamp;
+  struct tm tm;
+  localtime_r(&timestamp, &tm);
+  char time[32];
+  strftime(time, sizeof time, "[%Y-%m-%d %H:%M:%S] ", &tm);
+  out += "event: ";
+  out += EVENTS[record.result];
+  out += "\ndata: ";
+  size_t data = out.length();
+  out += time;
+  switch (record.result) {
+    case LOG_GRANTED:
+      out.append(record.name());
+      out += ": ";
+      out.append(record.key());
+      break;
+    case LOG_DENIED:
+      out += "<UNAUTHORIZED>: ";
+      out.append(record.key());
+      break;
+    default:
+      out.append(record.message());
+      break;
+  }
+  // a newline would end the data field early
+  std::replace_if(out.begin() + data, out.end(), [](char c) -> bool { return c == '\n' || c == '\r'; }, ' ');
+  out += "\n\n";
+}
+
 esp_err_t AclServer::acl_get(httpd_req_t *r) {
-  optional<std::string> res = store_->load_acl_content();
-  if (!res.has_value()) {
+  if (!content_) {
     httpd_resp_set_status(r, HTTPD_404);
     httpd_resp_send(r, "Not found", HTTPD_RESP_USE_STRLEN);
     return ESP_OK;
   }
+  // rendered from the list in memory, tagged with the version it was taken at
+  AclContent content = content_();
+  size_t size = 0;
+  content.acl->for_each([&size](const AclRecord &record) -> void {
+    size += record.name.size() + record.key.size() + 2;
+  });
+  bool gzip = accepts_gzip_(r) && !request_has_header(r, "Range");
+  std::string etag;
+  std::string last_modified;
+  acl_tags_(content.version, gzip, etag, last_modified);
+  if (not_modified_(r, etag, last_modified)) {
+    return ESP_OK;
+  }
 
+  size_t offset = 0;
+  size_t length = size;
+  std::string content_range;
+  if (!apply_range_(r, etag, size, offset, length)) {
+    return ESP_OK;
+  }
+  if (length != size) {
+    content_range = string_format("bytes %u-%u/%u", (unsigned) offset, (unsigned) (offset + length - 1), (unsigned) size);
+  }
+
+  ResponseWriter out(r, gzip);
+  if (out.out_of_memory()) {
+    return send_unavailable_(r);
+  }
+  send_headers_(r, etag, last_modified, content_range, gzip);
+  // only a chunk of lines is held at a time, the list is never copied as a whole
+  std::string chunk;
+  chunk.reserve(CHUNK_SIZE + MAX_LINE_LENGTH + 1);
+  std::string line;
+  line.reserve(MAX_LINE_LENGTH + 1);
+  size_t pos = 0;
+  size_t end = offset + length;
+  bool sent = true;
+  content.acl->for_each([&](const AclRecord &record) -> void {
+    size_t next = pos + record.name.size() + record.key.size() + 2;
+    if (sent && next > offset && pos < end) {
+      line.assign(record.name.data(), record.name.size());
+      line += ',';
+      line.append(record.key.data(), record.key.size());
+      line += '\n';
+      size_t from = offset > pos ? offset - pos : 0;
+      chunk.append(line, from, std::min(next, end) - pos - from);
+      sent = send_chunk_(out, chunk, CHUNK_SIZE);
+    }
+    pos = next;
+  });
+  if (!sent || !send_chunk_(out, chunk) || !out.finish()) {
+    return ESP_FAIL;
+  }
+  return ESP_OK;
+}
+
+void AclServer::acl_tags_(const AclVersion &version, bool gzip, std::string &etag, std::string &last_modified) {
+  etag = string_format("\"%x-%x%s\"", (unsigned) version.epoch, (unsigned) version.generation, gzip ? "-gz" : "");
+  last_modified = http_date_(version.modified);
+}
+
+void AclServer::send_headers_(httpd_req_t *r, const std::string &etag, const std::string &last_modified,
+                              const std::string &content_range, bool gzip) {
   httpd_resp_set_hdr(r, "Content-Type", "text/plain");
+  httpd_resp_set_hdr(r, "Vary", "Accept-Encoding");
+  if (gzip) {
+    httpd_resp_set_hdr(r, "Content-Encoding", "gzip");
+  }
+  // no-cache still lets clients revalidate with the tags below
+  if (!etag.empty()) {
+    httpd_resp_set_hdr(r, "ETag", etag.c_str());
+  }
+  if (!last_modified.empty()) {
+    httpd_resp_set_hdr(r, "Last-Modified", last_modified.c_str());
+  }
   httpd_resp_set_hdr(r, "CDN-Cache-Control", "no-store");
   httpd_resp_set_hdr(r, "Cache-Control", "no-cache");
   httpd_resp_set_hdr(r, "Pragma", "no-cache");
   httpd_resp_set_hdr(r, "Expires", "0");
-  httpd_resp_set_hdr(r, "Connection", "close");
+  if (!content_range.empty()) {
+    httpd_resp_set_hdr(r, "Content-Range", content_range.c_str());
+    httpd_resp_set_status(r, "206 Partial Content");
+  } else {
+    httpd_resp_set_status(r, HTTPD_200);
+  }
+}
+
+bool AclServer::apply_range_(httpd_req_t *r, const std::string &etag, size_t size, size_t &offset, size_t &length) {
+  optional<std::string> range = request_get_header(r, "Range");
+  if (!range.has_value()) {
+    return true;
+  }
+  // a range is only meant for the version the client already has part of
+  optional<std::string> if_range = request_get_header(r, "If-Range");
+  if (if_range.has_value() && if_range.value() != etag) {
+    return true;
+  }
+  if (parse_range_(range.value(), size, offset, length)) {
+    return true;
+  }
+  std::string content_range = string_format("bytes */%u", (unsigned) size);
+  httpd_resp_set_status(r, "416 Range Not Satisfiable");
+  httpd_resp_set_hdr(r, "Content-Range", content_range.c_str());
+  httpd_resp_send(r, nullptr, 0);
+  return false;
+}
+
+bool AclServer::parse_range_(const std::string &range, size_t size, size_t &offset, size_t &length) {
+  // only a single "bytes=first-last", "bytes=first-" or "bytes=-suffix" range is supported,
+  // anything else is ignored and answered with the whole content
+  if (range.compare(0, 6, "bytes=") != 0 || range.find(',') != std::string::npos) {
+    return true;
+  }
+  size_t dash = range.find('-', 6);
+  if (dash == std::string::npos) {
+    return true;
+  }
+  std::string first = range.substr(6, dash - 6);
+  std::string last = range.substr(dash + 1);
+  if (first.empty() && last.empty()) {
+    return true;
+  }
+  for (const std::string &part: {first, last}) {
+    if (part.find_first_not_of("0123456789") != std::string::npos) {
+      return true;
+    }
+  }
+  if (first.empty()) {
+    // the last n bytes
+    size_t suffix = strtoul(last.c_str(), nullptr, 10);
+    if (suffix == 0 || size == 0) {
+      return false;
+    }
+    offset = suffix >= size ? 0 : size - suffix;
+    length = size - offset;
+    return true;
+  }
+  size_t start = strtoul(first.c_str(), nullptr, 10);
+  if (start >= size) {
+    return false;
+  }
+  size_t end = last.empty() ? size - 1 : std::min((size_t) strtoul(last.c_str(), nullptr, 10), size - 1);
+  if (end < start) {
+    return true;
+  }
+  offset = start;
+  length = end - start + 1;
+  return true;
+}
+
+esp_err_t AclServer::acl_post(httpd_req_t *r) {
+  ESP_LOGI(TAG, "Receiving %u bytes", (unsigned) r->content_len);
+  std::string encoding = request_get_header(r, "Content-Encoding").value_or("identity");
+  bool gzip = encoding == "gzip";
+  if (!gzip && encoding != "identity") {
+    httpd_resp_set_status(r, "415 Unsupported Media Type");
+    httpd_resp_send(r, "Only gzip is supported", HTTPD_RESP_USE_STRLEN);
+    return ESP_OK;
+  }
+  bool valid = true;
+  LineReader reader([&valid](std::string_view line) -> bool {
+    AclRecord record;
+    valid = line.empty() || AclStore::parse_acl_line(line, record);
+    return valid;
+  });
+  size_t received = 0;
+  int error = 0;
+  bool corrupt = false;
+  bool out_of_memory = false;
+  bool stored = store_->store_acl_content([r, gzip, &reader, &received, &error, &corrupt, &out_of_memory](
+                                              const sdmmc::SdFs::Writer &write) -> bool {
+    auto receive = [r, &received, &error](char *buffer, size_t size) -> int {
+      if (received >= r->content_len) {
+        return 0;
+      }
+      const int ret = httpd_req_recv(r, buffer, std::min(size, (size_t) (r->content_len - received)));
+      if (ret <= 0) {  // 0 return value indicates connection closed
+        error = ret == HTTPD_SOCK_ERR_TIMEOUT ? ret : HTTPD_SOCK_ERR_FAIL;
+        return -1;
+      }
+      received += ret;
+      return ret;
+    };
+    // rows are checked as they arrive, the upload never sits in memory as a whole
+    bool written = true;
+    auto store = [&reader, &write, &written](const char *data, const size_t length) -> bool {
+      written = reader.feed(data, length) && write(data, length);
+      return written;
+    };
+    if (gzip) {
+      // acl.csv is stored inflated, the stream is checked against its CRC before it is installed
+      GzipDecoder decoder(receive, store);
+      if (!decoder.run()) {
+        out_of_memory = decoder.out_of_memory();
+        corrupt = !out_of_memory && error == 0 && written;
+        return false;
+      }
+    } else {
+      char buffer[RECEIVE_BUFFER_SIZE];
+      int ret;
+      while ((ret = receive(buffer, sizeof buffer)) > 0) {
+        if (!store(buffer, ret)) {
+          return false;
+        }
+      }
+      if (ret < 0) {
+        return false;
+      }
+    }
+    return reader.finish();
+  });
+  ESP_LOGI(TAG, "Received %u bytes", (unsigned) received);
+
+  if (error == HTTPD_SOCK_ERR_TIMEOUT) {
+    httpd_resp_send_err(r, HTTPD_408_REQ_TIMEOUT, nullptr);
+    return ESP_ERR_TIMEOUT;
+  } else if (error != 0) {
+    httpd_resp_send_err(r, HTTPD_400_BAD_REQUEST, nullptr);
+    return ESP_FAIL;
+  } else if (out_of_memory) {
+    return send_unavailable_(r);
+  } else if (corrupt) {
+    httpd_resp_send_err(r, HTTPD_400_BAD_REQUEST, "Invalid gzip data");
+    return ESP_OK;
+  } else if (reader.failed()) {
+    std::string message = string_format("Line %u is %s", (unsigned) reader.line_number(), valid ? "too long" : "not a valid name,key entry");
+    ESP_LOGW(TAG, "Rejected acl.csv upload: %s", message.c_str());
+    httpd_resp_send_err(r, HTTPD_400_BAD_REQUEST, message.c_str());
+    return ESP_OK;
+  } else if (!stored) {
+    httpd_resp_send_err(r, HTTPD_500_INTERNAL_SERVER_ERROR, "Unable to store acl.csv");
+    return ESP_OK;
+  }
   httpd_resp_set_status(r, HTTPD_200);
-  httpd_resp_send(r, res.value().c_str(), HTTPD_RESP_USE_STRLEN);
+  httpd_resp_send(r, "OK", HTTPD_RESP_USE_STRLEN);
+  reload_();
+  return ESP_OK;
+}
+
+esp_err_t AclServer::acl_changes(httpd_req_t *r) {
+  std::string query = request_get_query(r).value_or("");
+  optional<std::string> since = query_get_param(query, "since");
+  optional<std::string> epoch = query_get_param(query, "epoch");
+  char *end;
+  uint32_t generation = since.has_value() ? strtoul(since->c_str(), &end, 10) : 0;
+  if (!since.has_value() || since->empty() || *end != '\0') {
+    httpd_resp_send_err(r, HTTPD_400_BAD_REQUEST, "Invalid since");
+    return ESP_OK;
+  }
+  AclVersion version = version_ ? version_() : AclVersion{};
+  // the version is taken first, changes made meanwhile are sent again on the next sync, which is harmless
+  std::string body = string_format("%u,%u\n", (unsigned) version.epoch, (unsigned) version.generation);
+  bool known = changes_ != nullptr && generation <= version.generation &&
+      (!epoch.has_value() || strtoul(epoch->c_str(), &end, 10) == version.epoch) &&
+      changes_->since(generation, [&body](const AclChange &change) -> void {
+    body += change.add ? '+' : '-';
+    if (change.add) {
+      body += change.name;
+      body += ',';
+    }
+    body += change.key;
+    body += '\n';
+  });
+  if (!known) {
+    // rebooted, replaced as a whole or too far behind
+    httpd_resp_set_status(r, "410 Gone");
+    httpd_resp_send(r, "Fetch acl.csv instead", HTTPD_RESP_USE_STRLEN);
+    return ESP_OK;
+  }
+  httpd_resp_set_type(r, "text/plain");
+  httpd_resp_set_hdr(r, "Cache-Control", "no-cache");
+  httpd_resp_send(r, body.c_str(), body.length());
   return ESP_OK;
 }
 
-esp_err_t AclServer::acl_post(httpd_req_t *r, std::string&& post_body) {
-  store_->store_acl_content(post_body);
-  post_body = "";
-  httpd_resp_set_hdr(r, "Connection", "close");
+esp_err_t AclServer::acl_patch(httpd_req_t *r) {
+  if (r->content_len > MAX_PATCH_SIZE) {
+    httpd_resp_set_status(r, "413 Payload Too Large");
+    httpd_resp_send(r, "Too many changes, upload acl.csv instead", HTTPD_RESP_USE_STRLEN);
+    return ESP_OK;
+  }
+  // same format as acl.journal, nothing is applied unless every line is valid
+  std::vector<AclChange> changes;
+  LineReader reader([&changes](std::string_view line) -> bool {
+    AclRecord record;
+    if (line.empty()) {
+      return true;
+    } else if (line[0] == '+' && AclStore::parse_acl_line(line.substr(1), record)) {
+      changes.push_back(AclChange{0, true, std::string(record.name), std::string(record.key)});
+      return true;
+    } else if (line[0] == '-' && AclStore::is_valid_key(line.substr(1))) {
+      changes.push_back(AclChange{0, false, "", std::string(line.substr(1))});
+      return true;
+    }
+    return false;
+  });
+  char buffer[RECEIVE_BUFFER_SIZE];
+  size_t received = 0;
+  while (received < r->content_len) {
+    const int ret = httpd_req_recv(r, buffer, std::min(sizeof buffer, (size_t) (r->content_len - received)));
+    if (ret <= 0) {
+      bool timeout = ret == HTTPD_SOCK_ERR_TIMEOUT;
+      httpd_resp_send_err(r, timeout ? HTTPD_408_REQ_TIMEOUT : HTTPD_400_BAD_REQUEST, nullptr);
+      return timeout ? ESP_ERR_TIMEOUT : ESP_FAIL;
+    }
+    received += ret;
+    if (!reader.feed(buffer, ret)) {
+      break;
+    }
+  }
+  if (reader.failed() || !reader.finish()) {
+    std::string message = string_format("Line %u is not a valid +name,key or -key change", (unsigned) reader.line_number());
+    ESP_LOGW(TAG, "Rejected acl patch: %s", message.c_str());
+    httpd_resp_send_err(r, HTTPD_400_BAD_REQUEST, message.c_str());
+    return ESP_OK;
+  }
+  ESP_LOGI(TAG, "Received acl patch with %u changes", (unsigned) changes.size());
+  if (!changes.empty() && patch_) {
+    patch_(std::move(changes));
+  }
   httpd_resp_set_status(r, HTTPD_200);
   httpd_resp_send(r, "OK", HTTPD_RESP_USE_STRLEN);
-  reload_();
   return ESP_OK;
 }
 
+bool AclServer::not_modified_(httpd_req_t *r, const std::string &etag, const std::string &last_modified) {
+  bool match = false;
+  optional<std::string> header = request_get_header(r, "If-None-Match");
+  if (header.has_value()) {
+    // If-Modified-Since is ignored when If-None-Match is present
+    match = !etag.empty() && (header.value() == "*" || header->find(etag) != std::string::npos);
+  } else if (!last_modified.empty()) {
+    // clients send back the value they were given, so no date parsing is needed
+    header = request_get_header(r, "If-Modified-Since");
+    match = header.has_value() && header.value() == last_modified;
+  }
+  if (!match) {
+    return false;
+  }
+  httpd_resp_set_status(r, "304 Not Modified");
+  httpd_resp_set_hdr(r, "ETag", etag.c_str());
+  httpd_resp_set_hdr(r, "Vary", "Accept-Encoding");
+  httpd_resp_set_hdr(r, "Cache-Control", "no-cache");
+  httpd_resp_send(r, nullptr, 0);
+  return true;
+}
+
+bool AclServer::send_chunk_(ResponseWriter &out, std::string &chunk, size_t min_length) {
+  if (chunk.empty() || chunk.length() < min_length) {
+    return true;
+  }
+  bool sent = out.write(chunk.data(), chunk.length());
+  chunk.clear();
+  return sent;
+}
+
+esp_err_t AclServer::send_unavailable_(httpd_req_t *r) {
+  // too little memory for the request right now, which passes like a full queue
+  httpd_resp_set_status(r, "503 Service Unavailable");
+  httpd_resp_set_hdr(r, "Retry-After", "1");
+  httpd_resp_send(r, "Busy", HTTPD_RESP_USE_STRLEN);
+  return ESP_OK;
+}
+
+bool AclServer::accepts_gzip_(httpd_req_t *r) {
+  optional<std::string> header = request_get_header(r, "Accept-Encoding");
+  size_t pos = header.has_value() ? header->find("gzip") : std::string::npos;
+  if (pos == std::string::npos) {
+    return false;
+  }
+  // "gzip;q=0" explicitly refuses it
+  size_t end = header->find(',', pos);
+  std::string params = header->substr(pos + 4, end == std::string::npos ? end : end - pos - 4);
+  size_t q = params.find("q=");
+  return q == std::string::npos || strtod(params.c_str() + q + 2, nullptr) > 0;
+}
+
+ResponseWriter::ResponseWriter(httpd_req_t *r, bool gzip): r_(r) {
+  if (gzip) {
+    gzip_ = std::make_unique<GzipEncoder>([r](const char *data, const size_t length) -> bool {
+      return httpd_resp_send_chunk(r, data, length) == ESP_OK;
+    });
+    ok_ = !gzip_->out_of_memory();
+  }
+}
+
+bool ResponseWriter::write(const char *data, size_t length) {
+  if (ok_ && length > 0) {
+    ok_ = gzip_ ? gzip_->write(data, length) : httpd_resp_send_chunk(r_, data, length) == ESP_OK;
+  }
+  return ok_;
+}
+
+bool ResponseWriter::finish() {
+  if (ok_ && gzip_) {
+    ok_ = gzip_->finish();
+  }
+  ok_ = ok_ && httpd_resp_send_chunk(r_, nullptr, 0) == ESP_OK;
+  return ok_;
+}
+
+std::string AclServer::http_date_(time_t time) {
+  if (time < MIN_VALID_TIME) {
+    return "";
+  }
+  struct tm tm;
+  gmtime_r(&time, &tm);
+  char date[32];
+  strftime(date, sizeof date, "%a, %d %b %Y %H:%M:%S GMT", &tm);
+  return date;
+}
+
+optional<std::string> AclServer::request_get_query(httpd_req_t *req) {
+  size_t len = httpd_req_get_url_query_len(req);
+  if (len == 0) {
+    return {};
+  }
+
+  std::string str;
+  str.resize(len);
+
+  auto res = httpd_req_get_url_query_str(req, &str[0], len + 1);
+  if (res != ESP_OK) {
+    return {};
+  }
+
+  return {str};
+}
+
+optional<std::string> AclServer::query_get_param(const std::string &query, const char *name) {
+  char value[MAX_LINE_LENGTH];
+  if (httpd_query_key_value(query.c_str(), name, value, sizeof value) != ESP_OK) {
+    return {};
+  }
+  // values are percent encoded
+  std::string res;
+  for (const char *c = value; *c != '\0'; c++) {
+    if (*c == '+') {
+      res += ' ';
+    } else if (*c == '%' && isxdigit(c[1]) && isxdigit(c[2])) {
+      char hex[3] = {c[1], c[2], '\0'};
+      res += (char) strtoul(hex, nullptr, 16);
+      c += 2;
+    } else {
+      res += *c;
+    }
+  }
+  return res;
+}
+
 bool AclServer::request_has_header(httpd_req_t *req, const char *name) { return httpd_req_get_hdr_value_len(req, name); }
 
 optional<std::string> AclServer::request_get_header(httpd_req_t *req, const char *name) {
@@ -0,0 +1,99 @@
+#include "acl_snapshot.h"
+
+namespace esphome {
+namespace acl {
+
+optional<AclRecord> AclSnapshot::find(std::string_view key) const {
+  if (overlay_) {
+    auto res = overlay_->find(key);
+    if (res.has_value()) {
+      if (res->name.empty()) {
+        return {};
+      }
+      return res;
+    }
+  }
+  return base_->find(key);
+}
+
+optional<AclRecord> AclSnapshot::find_hash(uint32_t hash) const {
+  if (overlay_) {
+    auto res = overlay_->find_hash(hash);
+    if (res.has_value()) {
+      if (res->name.empty()) {
+        return {};
+      }
+      return res;
+    }
+  }
+  auto res = base_->find_hash(hash);
+  if (res.has_value() && overlay_ && overlay_->find(res->key).has_value()) {
+    // removed or renamed since the base was loaded
+    return find(res->key);
+  }
+  return res;
+}
+
+AclSnapshot *AclSnapshot::with_insert(std::string_view name, std::string_view key) const {
+  AclSnapshot *acl = copy();
+  acl->insert(name, key);
+  return acl;
+}
+
+AclSnapshot *AclSnapshot::with_erase(std::string_view key) const {
+  AclSnapshot *acl = copy();
+  acl->erase(key);
+  return acl;
+}
+
+void AclSnapshot::insert(std::string_view name, std::string_view key) {
+  if (!find(key).has_value()) {
+    size_++;
+  }
+  writable_overlay_().insert(name, key);
+}
+
+void AclSnapshot::erase(std::string_view key) {
+  if (!find(key).has_value()) {
+    return;
+  }
+  if (base_->find(key).has_value()) {
+    writable_overlay_().insert("", key);
+  } else {
+    writable_overlay_().erase(key);
+  }
+  size_--;
+}
+
+bool AclSnapshot::merge_into(AclTable &table, size_t &cursor, size_t count) const {
+  size_t base = base_->capacity();
+  size_t end = base + (overlay_ ? overlay_->capacity() : 0);
+  for (; count > 0 && cursor < end; count--, cursor++) {
+    // the keys of both tables are unique once the ones in the overlay are skipped in the base
+    if (cursor < base) {
+      if (base_->slot_used(cursor)) {
+        AclRecord record = base_->slot_record(cursor);
+        if (!overlay_ || !overlay_->find(record.key).has_value()) {
+          table.restore_record(base_->slot_hash(cursor), record.name, record.key);
+        }
+      }
+    } else if (overlay_->slot_used(cursor - base)) {
+      AclRecord record = overlay_->slot_record(cursor - base);
+      if (!record.name.empty()) {
+        table.restore_record(overlay_->slot_hash(cursor - base), record.name, record.key);
+      }
+    }
+  }
+  return cursor < end;
+}
+
+AclTable &AclSnapshot::writable_overlay_() {
+  if (!writable_) {
+    writable_ = overlay_ ? std::make_shared<AclTable>(*overlay_) : std::make_shared<AclTable>();
+    overlay_ = writable_;
+  }
+  return *writable_;
+}
+
+}  // namespace acl
+}  // namespace esphome
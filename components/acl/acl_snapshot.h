@@ -0,0 +1,137 @@
+#pragma once
+
+#include <atomic>
+#include <memory>
+
+#include "acl_table.h"
+
+namespace esphome {
+namespace acl {
+
+/// Immutable view of the ACL that check() reads from.
+///
+/// It combines a shared base table with a small overlay holding the changes made
+/// since the base was loaded. A removed key is kept in the overlay with an empty
+/// name, which is never a valid entry. Changes produce a new snapshot that shares
+/// the base, so an add or remove only copies the overlay. A batch or patch copies it once for all of
+/// its changes, through a copy() changed with insert() and erase() before it is published.
+class AclSnapshot {
+  public:
+    AclSnapshot(): base_(std::make_shared<const AclTable>()) {}
+    AclSnapshot(std::shared_ptr<const AclTable> base, std::shared_ptr<const AclTable> overlay, size_t size):
+      base_(std::move(base)), overlay_(std::move(overlay)), size_(size) {}
+
+    optional<AclRecord> find(std::string_view key) const;
+    optional<AclRecord> find_hash(uint32_t hash) const;
+    size_t size() const { return size_; }
+    bool empty() const { return size_ == 0; }
+    size_t overlay_size() const { return overlay_ ? overlay_->size() : 0; }
+    const std::shared_ptr<const AclTable> &base() const { return base_; }
+
+    AclSnapshot *with_insert(std::string_view name, std::string_view key) const;
+    AclSnapshot *with_erase(std::string_view key) const;
+    /// A snapshot sharing both tables. The first insert() or erase() on it copies the overlay, later ones change
+    /// that copy in place, so they may only be called until it is published.
+    AclSnapshot *copy() const { return new AclSnapshot(base_, overlay_, size_); }
+    void insert(std::string_view name, std::string_view key);
+    void erase(std::string_view key);
+    /// Folds the overlay into a new base table a part at a time: copies the entries of up to count slots, those
+    /// of the base first and then of the overlay, into table from cursor on. Returns false once all are copied.
+    bool merge_into(AclTable &table, size_t &cursor, size_t count) const;
+
+    /// References held through AclSnapshotRef, a retired snapshot is only freed once there are none.
+    void acquire() const { refs_++; }
+    void release() const { refs_--; }
+    bool referenced() const { return refs_ > 0; }
+
+    template<typename F> void for_each(F callback) const {
+      if (overlay_) {
+        overlay_->for_each([&callback](const AclRecord &record) -> void {
+          if (!record.name.empty()) {
+            callback(record);
+          }
+        });
+      }
+      base_->for_each([this, &callback](const AclRecord &record) -> void {
+        if (!overlay_ || !overlay_->find(record.key).has_value()) {
+          callback(record);
+        }
+      });
+    }
+
+    /// Calls back with every entry of a name, through the name index of both tables.
+    template<typename F> void for_each_of(std::string_view name, F callback) const {
+      if (name.empty()) {
+        return;
+      }
+      if (overlay_) {
+        overlay_->for_each_of(name, callback);
+      }
+      base_->for_each_of(name, [this, &callback](const AclRecord &record) -> void {
+        if (!overlay_ || !overlay_->find(record.key).has_value()) {
+          callback(record);
+        }
+      });
+    }
+
+  protected:
+    std::shared_ptr<const AclTable> base_;
+    std::shared_ptr<const AclTable> overlay_;
+    size_t size_{0};
+    mutable std::atomic<uint32_t> refs_{0};
+    /// The overlay once it is a copy of this snapshot's own.
+    std::shared_ptr<AclTable> writable_;
+
+    AclTable &writable_overlay_();
+};
+
+/// Keeps a snapshot alive for as long as it is held. Taking and dropping one does not allocate.
+class AclSnapshotRef {
+  public:
+    AclSnapshotRef() = default;
+    explicit AclSnapshotRef(const AclSnapshot *snapshot): snapshot_(snapshot) {
+      if (snapshot_ != nullptr) {
+        snapshot_->acquire();
+      }
+    }
+    AclSnapshotRef(const AclSnapshotRef &other): AclSnapshotRef(other.snapshot_) {}
+    AclSnapshotRef(AclSnapshotRef &&other) noexcept: snapshot_(other.snapshot_) { other.snapshot_ = nullptr; }
+    AclSnapshotRef &operator=(AclSnapshotRef other) noexcept {
+      std::swap(snapshot_, other.snapshot_);
+      return *this;
+    }
+    ~AclSnapshotRef() {
+      if (snapshot_ != nullptr) {
+        snapshot_->release();
+      }
+    }
+
+    const AclSnapshot *get() const { return snapshot_; }
+    const AclSnapshot *operator->() const { return snapshot_; }
+    const AclSnapshot &operator*() const { return *snapshot_; }
+    explicit operator bool() const { return snapshot_ != nullptr; }
+
+  protected:
+    const AclSnapshot *snapshot_{nullptr};
+};
+
+/// A record found by AclComponent::check(). Used like optional<AclRecord>; the name and key stay
+/// valid for as long as it is held, however long the list is changed or reloaded meanwhile.
+class AclRecordRef {
+  public:
+    AclRecordRef() = default;
+    AclRecordRef(AclSnapshotRef snapshot, AclRecord record): snapshot_(std::move(snapshot)), record_(record) {}
+
+    bool has_value() const { return record_.has_value(); }
+    explicit operator bool() const { return record_.has_value(); }
+    const AclRecord &value() const { return record_.value(); }
+    const AclRecord &operator*() const { return record_.value(); }
+    const AclRecord *operator->() const { return &record_.value(); }
+
+  protected:
+    AclSnapshotRef snapshot_;
+    optional<AclRecord> record_;
+};
+
+}  // namespace acl
+}  // namespace esphome
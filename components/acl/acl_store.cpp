@@ -1,155 +1,1368 @@
 #include "acl_store.h"
+#include "line_reader.h"
+#include "util.h"
 #include "esphome/core/log.h"
 
+#include <algorithm>
+#include <cstring>
+#include <ctime>
+
 namespace esphome {
 namespace acl {
 
   static const char *const TAG = "acl_store";
 
-  optional<std::list<AclEntry>> AclStore::load_acl() {
-    std::list<AclEntry> data;
+  static const uint32_t SNAPSHOT_MAGIC = 0x424C4341;  // "ACLB"
+  static const uint16_t SNAPSHOT_VERSION = 2;
+
+  bool AclStore::load_acl(AclTable &table) {
+    load_begin();
+    LoadStatus status;
+    while ((status = load_step(table)) == LOAD_PENDING) {
+    }
+    return status == LOAD_DONE;
+  }
+
+  void AclStore::load_begin() {
+    journal_size_ = 0;
+    journal_damaged_ = false;
+    load_ = std::make_unique<AclLoad>();
     if (sdfs_ == nullptr) {
-      return data;
+      return;
+    }
+    if (sdfs_->exists("/" + path_ + "/acl.upload")) {
+      install_upload_();
+    }
+    // a compaction or upload that stopped between removing acl.csv and renaming its replacement
+    if (sdfs_->exists("/" + path_ + "/acl.tmp")) {
+      if (!sdfs_->exists("/" + path_ + "/acl.csv")) {
+        sdfs_->rename_file("/" + path_ + "/acl.tmp", "/" + path_ + "/acl.csv");
+      } else {
+        sdfs_->delete_file("/" + path_ + "/acl.tmp");
+      }
+    }
+
+    load_->source = sdfs_->file_info("/" + path_ + "/acl.csv");
+    if (!load_->source.has_value()) {
+      return;
+    }
+    optional<sdmmc::FileInfo> snapshot = sdfs_->file_info("/" + path_ + "/acl.bin");
+    if (snapshot.has_value()) {
+      load_->snapshot = std::make_unique<SnapshotReader>(load_->source.value(), snapshot->size, load_->table);
+    } else {
+      load_csv_begin_(*load_);
+    }
+  }
+
+  void AclStore::reload_begin() {
+    if (sdfs_ == nullptr || !acl_loaded_ || sdfs_->exists("/" + path_ + "/acl.upload")) {
+      load_begin();
+      return;
+    }
+    // changes of this store are counted in journal_size_, other writers are not
+    optional<sdmmc::FileInfo> journal = sdfs_->file_info("/" + path_ + "/acl.journal");
+    optional<sdmmc::FileInfo> source = sdfs_->file_info("/" + path_ + "/acl.csv");
+    bool touched = source.has_value() && source_.has_value() && source->mtime != source_->mtime;
+    if ((journal.has_value() ? journal->size : 0) != journal_size_ || source.has_value() != source_.has_value() ||
+        (source.has_value() && (source->size != source_->size || (touched && !source_hash_.has_value())))) {
+      load_begin();
+      return;
+    }
+    load_ = std::make_unique<AclLoad>();
+    load_->source = source;
+    // copied again or touched, hashing it a step at a time is still cheaper than parsing and comparing the list
+    load_->verify = touched;
+    load_->unchanged = !touched;
+    load_->hash = fnv1a_hash(nullptr, 0);
+  }
+
+  void AclStore::load_csv_begin_(AclLoad &load) {
+    load.table.clear();
+    // the csv and the pool hold the same characters, so the file size is a good pool estimate
+    load.table.reserve(0, load.source->size);
+    load.offset = 0;
+    load.hash = fnv1a_hash(nullptr, 0);
+    load.csv = std::make_unique<LineReader>([&load](std::string_view line) -> bool {
+      if (line.empty()) {
+        return true;
+      }
+      AclRecord record;
+      if (!parse_acl_line(line, record)) {
+        load.csv_valid = false;
+        return false;
+      }
+      load.table.insert(record.name, record.key);
+      return true;
+    });
+  }
+
+  LoadStatus AclStore::load_step(AclTable &table) {
+    if (!load_) {
+      return LOAD_FAILED;
+    }
+    AclLoad &load = *load_;
+    if (load.unchanged) {
+      load_.reset();
+      return LOAD_UNCHANGED;
+    }
+    if (load.verify) {
+      size_t read = 0;
+      bool ok = sdfs_->read_file("/" + path_ + "/acl.csv", load.offset, LOAD_STEP_SIZE,
+                                 [&load, &read](const char *data, const size_t length) -> bool {
+        read += length;
+        load.hash = fnv1a_hash(data, length, load.hash);
+        return true;
+      });
+      load.offset += read;
+      if (ok && read == LOAD_STEP_SIZE) {
+        return LOAD_PENDING;
+      }
+      if (ok && load.offset == load.source->size && load.hash == source_hash_.value()) {
+        source_ = load.source;
+        load_.reset();
+        return LOAD_UNCHANGED;
+      }
+      // replaces this load
+      load_begin();
+      return LOAD_PENDING;
+    }
+    if (load.snapshot || load.csv) {
+      const std::string file = "/" + path_ + (load.snapshot ? "/acl.bin" : "/acl.csv");
+      size_t read = 0;
+      bool fed = true;
+      bool ok = sdfs_->read_file(file, load.offset, LOAD_STEP_SIZE, [&load, &read, &fed](const char *data, const size_t length) -> bool {
+        read += length;
+        if (load.snapshot) {
+          fed = load.snapshot->feed(data, length);
+        } else {
+          load.hash = fnv1a_hash(data, length, load.hash);
+          fed = load.csv->feed(data, length);
+        }
+        return fed;
+      });
+      load.offset += read;
+      if (ok && fed && read == LOAD_STEP_SIZE) {
+        return LOAD_PENDING;
+      }
+
+      if (load.snapshot) {
+        bool restored = ok && fed && load.snapshot->finish();
+        load.snapshot.reset();
+        if (restored) {
+          ESP_LOGD(TAG, "Loaded %u entries from acl.bin", (unsigned) load.table.size());
+        } else {
+          ESP_LOGW(TAG, "acl.bin is stale or damaged, parsing acl.csv");
+          load_csv_begin_(load);
+        }
+        return LOAD_PENDING;
+      }
+      if (!ok) {
+        load_.reset();
+        return LOAD_FAILED;
+      }
+      if (!fed || !load.csv->finish()) {
+        ESP_LOGE(TAG, "acl.csv line %u is %s", (unsigned) load.csv->line_number(),
+                 load.csv_valid ? "too long" : "not a valid name,key entry");
+        load_.reset();
+        return LOAD_FAILED;
+      }
+      load.csv.reset();
+      load.parsed = true;
+      load.writer = std::make_unique<SnapshotWriter>(load.source.value(), load.table);
+      return LOAD_PENDING;
+    }
+    if (load.writer) {
+      if (!write_snapshot_step_(*load.writer)) {
+        load.writer.reset();
+      }
+      return LOAD_PENDING;
+    }
+
+    if (sdfs_ != nullptr) {
+      replay_journal_(load.table);
     }
-    optional<std::string> contents = load_acl_content();
-    if (contents.has_value()) {
-      if (!load_acl_from_string_(contents.value(), data)) {
-        return {};
+    acl_loaded_ = true;
+    source_ = load.source;
+    // the hash is only known if acl.csv was parsed rather than acl.bin
+    source_hash_.reset();
+    if (load.parsed) {
+      source_hash_ = load.hash;
+    }
+    table = std::move(load.table);
+    load_.reset();
+    return LOAD_DONE;
+  }
+
+  bool AclStore::parse_acl_line(std::string_view line, AclRecord &record) {
+    size_t sep = line.find(',');
+    if (sep == std::string_view::npos) {
+      return false;
+    }
+    record.name = line.substr(0, sep);
+    record.key = line.substr(sep + 1);
+    return is_valid_entry(record.name, record.key);
+  }
+
+  bool AclStore::is_valid_entry(std::string_view name, std::string_view key) {
+    if (name.empty() || key.empty() || name.length() + key.length() + 1 > MAX_LINE_LENGTH) {
+      return false;
+    }
+    for (std::string_view part: {name, key}) {
+      for (char c: part) {
+        if ((uint8_t) c < 0x20 || c == 0x7f || c == ',') {
+          return false;
+        }
       }
     }
-    return data;
+    return true;
+  }
+
+  bool AclStore::is_valid_key(std::string_view key) {
+    // any name will do, only the key is checked
+    return is_valid_entry("-", key);
   }
-  
-  bool AclStore::load_acl_from_string_(const std::string &str, std::list<AclEntry> &data) {
-    std::size_t pos = 0;
-    std::size_t res;
-    while ((res = str.find("\n", pos)) != std::string::npos) {
-      if (!load_acl_entry_(str.substr(pos, res - pos), data)) {
+
+  bool SnapshotReader::feed(const char *data, size_t length) {
+    size_t i = 0;
+    if (header_read_ < sizeof header_) {
+      size_t n = std::min(length, sizeof header_ - header_read_);
+      memcpy(reinterpret_cast<char*>(&header_) + header_read_, data, n);
+      header_read_ += n;
+      i += n;
+      if (header_read_ < sizeof header_) {
+        return true;
+      }
+      if (!valid_header_()) {
         return false;
       }
-      pos = res + 1;
+      checksum_ = fnv1a_hash(nullptr, 0);
+      hashes_.reserve(header_.count);
+      table_.restore_begin(header_.count, header_.pool_size);
     }
-    if (pos < str.length()) {
-      return load_acl_entry_(str.substr(pos, str.length() - pos), data);
+
+    while (i < length) {
+      if (hashes_.size() < header_.count) {
+        // little endian words that may straddle chunks
+        size_t n = std::min(length - i, sizeof word_ - word_read_);
+        memcpy(word_ + word_read_, data + i, n);
+        checksum_ = fnv1a_hash(data + i, n, checksum_);
+        word_read_ += n;
+        i += n;
+        if (word_read_ < sizeof word_) {
+          break;
+        }
+        word_read_ = 0;
+        uint32_t value;
+        memcpy(&value, word_, sizeof value);
+        hashes_.push_back(value);
+        continue;
+      }
+      if (pool_read_ == header_.pool_size) {
+        // the checksum, nothing may follow it
+        size_t n = std::min(length - i, sizeof word_ - word_read_);
+        memcpy(word_ + word_read_, data + i, n);
+        word_read_ += n;
+        i += n;
+        if (i < length) {
+          return false;
+        }
+        break;
+      }
+      size_t n = std::min(length - i, (size_t) header_.pool_size - pool_read_);
+      pool_read_ += n;
+      checksum_ = fnv1a_hash(data + i, n, checksum_);
+      // the table interns the names as the records are restored
+      for (const char *p = data + i, *end = data + i + n; p < end;) {
+        const char *nul = static_cast<const char*>(memchr(p, '\0', end - p));
+        record_.append(p, (nul != nullptr ? nul : end) - p);
+        if (nul == nullptr) {
+          break;
+        }
+        p = nul + 1;
+        if (key_length_ == std::string::npos) {
+          key_length_ = record_.size();
+          record_ += '\0';
+          continue;
+        }
+        if (restored_ >= hashes_.size()) {
+          return false;
+        }
+        std::string_view view(record_);
+        table_.restore_record(hashes_[restored_++], view.substr(key_length_ + 1), view.substr(0, key_length_));
+        record_.clear();
+        key_length_ = std::string::npos;
+      }
+      i += n;
     }
     return true;
   }
-  
-  bool AclStore::load_acl_entry_(const std::string &str, std::list<AclEntry> &data) {
-    // TODO perform format checks and return false if invalid
 
-    std::size_t sep = str.find(",");
-    std::string name = str.substr(0, sep);
-    std::string key = str.substr(sep+1, str.length());
-    AclEntry entry(name, key);
-    data.emplace_back(std::move(entry));
+  bool SnapshotReader::valid_header_() const {
+    // checked before anything is reserved: the sizes have to add up to the file, and the pool holds the
+    // characters of acl.csv without its separators, so a damaged header asks for no more than parsing would
+    return header_.magic == SNAPSHOT_MAGIC && header_.version == SNAPSHOT_VERSION && header_.header_size == sizeof header_ &&
+           header_.source_size == source_.size && header_.source_mtime == (uint32_t) source_.mtime &&
+           header_.pool_size <= source_.size && header_.count <= header_.pool_size / 4 &&
+           (uint64_t) sizeof header_ + (uint64_t) header_.count * sizeof(uint32_t) + header_.pool_size + sizeof(uint32_t) == size_;
+  }
+
+  bool SnapshotReader::finish() const {
+    uint32_t checksum;
+    memcpy(&checksum, word_, sizeof checksum);
+    return header_read_ == sizeof header_ && restored_ == header_.count && record_.empty() &&
+           pool_read_ == header_.pool_size && word_read_ == sizeof word_ && checksum == checksum_;
+  }
+
+  SnapshotWriter::SnapshotWriter(const sdmmc::FileInfo &source, const AclTable &table): table_(table) {
+    header_.magic = SNAPSHOT_MAGIC;
+    header_.version = SNAPSHOT_VERSION;
+    header_.header_size = sizeof header_;
+    header_.count = table.size();
+    header_.pool_size = table.text_size();
+    header_.source_size = source.size;
+    header_.source_mtime = source.mtime;
+  }
+
+  bool SnapshotWriter::next(std::string &output, size_t length) {
+    if (!started_) {
+      started_ = true;
+      output.append(reinterpret_cast<const char*>(&header_), sizeof header_);
+      checksum_ = fnv1a_hash(nullptr, 0);
+    }
+    while (output.size() < length) {
+      if (index_ == table_.capacity()) {
+        if (records_) {
+          output.append(reinterpret_cast<const char*>(&checksum_), sizeof checksum_);
+          return false;
+        }
+        // the records follow in the same slot order as their hashes
+        records_ = true;
+        index_ = 0;
+        continue;
+      }
+      size_t index = index_++;
+      if (!table_.slot_used(index)) {
+        continue;
+      }
+      size_t start = output.size();
+      if (!records_) {
+        uint32_t hash = table_.slot_hash(index);
+        output.append(reinterpret_cast<const char*>(&hash), sizeof hash);
+      } else {
+        AclRecord record = table_.slot_record(index);
+        output.append(record.key.data(), record.key.size() + 1);
+        output.append(record.name.data(), record.name.size() + 1);
+      }
+      checksum_ = fnv1a_hash(output.data() + start, output.size() - start, checksum_);
+    }
     return true;
   }
 
-  void AclStore::store_acl(const std::list<AclEntry> &data) {
-    if (sdfs_ == nullptr) {
+  bool AclStore::write_snapshot_step_(SnapshotWriter &writer) {
+    // written aside, a snapshot cut short is never found as acl.bin
+    const std::string part = "/" + path_ + "/acl.bin.part";
+    bool first = !writer.started();
+    std::string output;
+    bool more = writer.next(output, LOAD_STEP_SIZE);
+    if (!(first ? sdfs_->write_file(part, output) : sdfs_->append_file(part, output))) {
+      ESP_LOGW(TAG, "Error saving acl.bin file");
+      sdfs_->delete_file(part);
+      return false;
+    }
+    if (more) {
+      return true;
+    }
+    sdfs_->delete_file("/" + path_ + "/acl.bin");
+    if (!sdfs_->rename_file(part, "/" + path_ + "/acl.bin")) {
+      ESP_LOGW(TAG, "Error saving acl.bin file");
+      sdfs_->delete_file(part);
+    }
+    return false;
+  }
+
+  bool AclStore::store_acl(std::shared_ptr<const AclTable> table) {
+    store_begin(std::move(table), journal_size_);
+    LoadStatus status;
+    while ((status = store_step()) == LOAD_PENDING) {
+    }
+    return status == LOAD_DONE;
+  }
+
+  void AclStore::store_begin(std::shared_ptr<const AclTable> table, size_t journal_size) {
+    store_ = std::make_unique<AclSave>();
+    store_->table = std::move(table);
+    store_->journal_size = journal_size;
+    store_->hash = fnv1a_hash(nullptr, 0);
+    if (sdfs_ != nullptr && !sdfs_->exists("/" + path_)) {
+      sdfs_->create_dir("/" + path_);
+    }
+  }
+
+  LoadStatus AclStore::store_step() {
+    if (!store_ || sdfs_ == nullptr) {
+      store_.reset();
+      return LOAD_FAILED;
+    }
+    AclSave &save = *store_;
+    const AclTable &table = *save.table;
+    if (save.writer) {
+      if (write_snapshot_step_(*save.writer)) {
+        return LOAD_PENDING;
+      }
+      store_.reset();
+      return LOAD_DONE;
+    }
+
+    // written aside first so that a failed write never leaves a partial acl.csv behind
+    const std::string file = "/" + path_ + "/acl.tmp";
+    std::string output;
+    for (; save.index < table.capacity() && output.size() < LOAD_STEP_SIZE; save.index++) {
+      if (!table.slot_used(save.index)) {
+        continue;
+      }
+      AclRecord record = table.slot_record(save.index);
+      output.append(record.name.data(), record.name.size());
+      output += ',';
+      output.append(record.key.data(), record.key.size());
+      output += '\n';
+    }
+    save.hash = fnv1a_hash(output.data(), output.size(), save.hash);
+    if (!(save.offset == 0 ? sdfs_->write_file(file, output) : sdfs_->append_file(file, output))) {
+      ESP_LOGE(TAG, "Error saving acl.csv file");
+      sdfs_->delete_file(file);
+      store_.reset();
+      return LOAD_FAILED;
+    }
+    save.offset += output.size();
+    if (save.index < table.capacity()) {
+      return LOAD_PENDING;
+    }
+
+    sdfs_->delete_file("/" + path_ + "/acl.bin");
+    sdfs_->delete_file("/" + path_ + "/acl.csv");
+    if (!sdfs_->rename_file(file, "/" + path_ + "/acl.csv")) {
+      ESP_LOGE(TAG, "Error replacing acl.csv file");
+      store_.reset();
+      return LOAD_FAILED;
+    }
+    trim_journal_(save.journal_size);
+    ESP_LOGD(TAG, "Stored %u entries to acl.csv", (unsigned) table.size());
+
+    // what was written is what is loaded, a reload right after is skipped
+    source_ = sdfs_->file_info("/" + path_ + "/acl.csv");
+    source_hash_ = save.hash;
+    if (!source_.has_value()) {
+      store_.reset();
+      return LOAD_DONE;
+    }
+    save.writer = std::make_unique<SnapshotWriter>(source_.value(), table);
+    return LOAD_PENDING;
+  }
+
+  void AclStore::trim_journal_(size_t offset) {
+    // changes journaled while the table was written are not in acl.csv and stay in the journal
+    const std::string file = "/" + path_ + "/acl.journal";
+    std::string rest;
+    if (journal_size_ > offset) {
+      sdfs_->read_file(file, offset, journal_size_ - offset, [&rest](const char *data, const size_t length) -> bool {
+        rest.append(data, length);
+        return true;
+      });
+    }
+    sdfs_->delete_file(file);
+    journal_size_ = 0;
+    journal_damaged_ = false;
+    if (rest.empty()) {
       return;
     }
-    std::string res;
-    for (auto const& entry: data) {
-      res += entry.name.c_str();
-      res += ",";
-      res += entry.key.c_str();
-      res += "\n";
+    if (!sdfs_->write_file(file, rest)) {
+      ESP_LOGE(TAG, "Error saving acl.journal");
+      // they are only in the list in memory now, the next store writes them
+      journal_damaged_ = true;
+      return;
     }
-    store_acl_content(res);
+    journal_size_ = rest.size();
+  }
+
+  bool AclStore::journal_add(std::string_view name, std::string_view key) {
+    std::string record;
+    record.reserve(name.size() + key.size() + 3);
+    record += '+';
+    record.append(name.data(), name.size());
+    record += ',';
+    record.append(key.data(), key.size());
+    record += '\n';
+    return append_journal_(record);
+  }
+
+  bool AclStore::journal_remove(std::string_view key) {
+    std::string record;
+    record.reserve(key.size() + 2);
+    record += '-';
+    record.append(key.data(), key.size());
+    record += '\n';
+    return append_journal_(record);
   }
 
-  void AclStore::store_logs(const std::vector<LogEntry> &logs) {
+  bool AclStore::journal_changes(const std::vector<AclChange> &changes) {
+    std::string records;
+    for (auto const& change: changes) {
+      if (change.add) {
+        records += '+';
+        records += change.name;
+        records += ',';
+      } else {
+        records += '-';
+      }
+      records += change.key;
+      records += '\n';
+    }
+    return append_journal_(records);
+  }
+
+  bool AclStore::append_journal_(const std::string &record) {
     if (sdfs_ == nullptr) {
-      return;
+      return false;
     }
     if (!sdfs_->exists("/" + path_)) {
       sdfs_->create_dir("/" + path_);
     }
-    if (!sdfs_->exists("/" + path_ + "/logs")) {
-      sdfs_->create_dir("/" + path_ + "/logs");
+    if (!sdfs_->append_file("/" + path_ + "/acl.journal", record)) {
+      ESP_LOGE(TAG, "Error appending to acl.journal");
+      return false;
     }
+    journal_size_ += record.length();
+    return true;
+  }
 
+  void AclStore::replay_journal_(AclTable &table) {
+    const std::string file = "/" + path_ + "/acl.journal";
+    optional<sdmmc::FileInfo> info = sdfs_->file_info(file);
+    if (!info.has_value()) {
+      return;
+    }
+    size_t applied = 0;
+    size_t skipped = 0;
+    LineReader reader([&table, &applied, &skipped](std::string_view line) -> bool {
+      AclRecord record;
+      if (line.size() > 1 && line[0] == '+' && parse_acl_line(line.substr(1), record)) {
+        table.insert(record.name, record.key);
+        applied++;
+      } else if (line.size() > 1 && line[0] == '-') {
+        table.erase(line.substr(1));
+        applied++;
+      } else if (!line.empty()) {
+        skipped++;
+      }
+      return true;
+    });
+    // a trailing line without newline is a torn append and is not replayed
+    sdfs_->read_file(file, [&reader](const char *data, const size_t length) -> bool {
+      return reader.feed(data, length);
+    });
+    if (reader.failed()) {
+      skipped++;
+    }
+    journal_size_ = info.value().size;
+    if (skipped > 0) {
+      ESP_LOGW(TAG, "Skipped %u damaged acl.journal records", (unsigned) skipped);
+      journal_damaged_ = true;
+    }
+    ESP_LOGD(TAG, "Replayed %u acl.journal records", (unsigned) applied);
+  }
+
+  size_t AclStore::store_logs(const LogRecord *records, size_t count) {
+    if (sdfs_ == nullptr) {
+      return count;
+    }
+    if (log_format_ == LOG_FORMAT_BINARY) {
+      return store_binary_logs_(records, count);
+    }
+    return store_text_logs_(records, count);
+  }
+
+  size_t AclStore::store_text_logs_(const LogRecord *records, size_t count) {
     std::string curfile;
     std::string content;
-    for (auto const& log: logs) {
-      size_t space = log.timestamp.find(' ');
-      std::string time;
-      if (space == std::string::npos) {
-        continue;
-      }
-      std::string file = log.timestamp.substr(0, space);
-      //time = log.timestamp.substr(space + 1, log.timestamp.length() - space - 1);
+    // the records from first on are in content, not yet on the card
+    size_t first = 0;
+    for (size_t i = 0; i < count; i++) {
+      const LogRecord &log = records[i];
+      time_t timestamp = log.timestamp;
+      struct tm tm;
+      localtime_r(&timestamp, &tm);
+      char file[16];
+      char time[32];
+      strftime(file, sizeof file, "%Y-%m-%d", &tm);
+      strftime(time, sizeof time, "[%Y-%m-%d %H:%M:%S] ", &tm);
       if (curfile != file) {
         if (!content.empty()) {
-          sdfs_->append_file("/" + path_ + "/logs/" + curfile + ".log", content);
+          if (!sdfs_->append_file(log_path_(curfile, ".log"), content)) {
+            return first;
+          }
           content.clear();
+          first = i;
         }
         curfile = file;
+        create_log_dir_(curfile);
       }
-      content += "[" + log.timestamp + "] " + log.message + "\r\n";
+      content += time;
+      switch (log.result) {
+        case LOG_GRANTED:
+          content.append(log.name());
+          content += ": ";
+          content.append(log.key());
+          break;
+        case LOG_DENIED:
+          content += "<UNAUTHORIZED>: ";
+          content.append(log.key());
+          break;
+        default:
+          content.append(log.message());
+          break;
+      }
+      content += "\r\n";
     }
 
-    if (!content.empty()) {
-      sdfs_->append_file("/" + path_ + "/logs/" + curfile + ".log", content);
-      content.clear();
+    if (!content.empty() && !sdfs_->append_file(log_path_(curfile, ".log"), content)) {
+      return first;
     }
+    return count;
   }
 
-  optional<std::string> AclStore::load_acl_content() {
+  bool AclStore::store_acl_content(std::function<bool(const sdmmc::SdFs::Writer&)> producer) {
     if (sdfs_ == nullptr) {
-      return {};
+      return false;
+    }
+
+    // called from the http server task, so acl.csv itself is left to install_upload_() on the main loop
+    if (!sdfs_->exists("/" + path_)) {
+      sdfs_->create_dir("/" + path_);
+    }
+    sdfs_->delete_file("/" + path_ + "/acl.part");
+    if (!sdfs_->write_file("/" + path_ + "/acl.part", producer)) {
+      ESP_LOGE(TAG, "Error saving uploaded acl.csv file");
+      sdfs_->delete_file("/" + path_ + "/acl.part");
+      return false;
     }
-    return sdfs_->read_file_string("/" + path_ + "/acl.csv");
+    sdfs_->delete_file("/" + path_ + "/acl.upload");
+    return sdfs_->rename_file("/" + path_ + "/acl.part", "/" + path_ + "/acl.upload");
   }
 
-  void AclStore::store_acl_content(const std::string &data) {
-    if (sdfs_ == nullptr) {
+  void AclStore::install_upload_() {
+    // claim the upload first, a newer one may replace acl.upload at any time
+    if (!sdfs_->rename_file("/" + path_ + "/acl.upload", "/" + path_ + "/acl.tmp")) {
       return;
     }
+    ESP_LOGI(TAG, "Installing uploaded acl.csv");
+    sdfs_->delete_file("/" + path_ + "/acl.bin");
+    sdfs_->delete_file("/" + path_ + "/acl.csv");
+    sdfs_->rename_file("/" + path_ + "/acl.tmp", "/" + path_ + "/acl.csv");
+    // the uploaded list replaces all earlier changes
+    sdfs_->delete_file("/" + path_ + "/acl.journal");
+  }
 
-    //ESP_LOGI(TAG, "Saving /acl.csv");
-    if (!sdfs_->exists("/" + path_)) {
-      sdfs_->create_dir("/" + path_);
+  size_t AclStore::store_binary_logs_(const LogRecord *records, size_t count) {
+    std::string curday;
+    std::string content;
+    std::string granted;
+    bool index_changed = false;
+    // the records from first on are in content, not yet on the card
+    size_t first = 0;
+    auto flush = [this, &curday, &content, &index_changed]() -> bool {
+      if (!content.empty()) {
+        if (!sdfs_->append_file(log_path_(curday, ".bin"), content)) {
+          // the index in memory counts records that are not on the card; .idx is left as it is and both are
+          // read back from the card when the records are stored again
+          index_day_.clear();
+          return false;
+        }
+        content.clear();
+      }
+      if (index_changed) {
+        sdfs_->write_file(log_path_(curday, ".idx"), std::string(reinterpret_cast<const char*>(index_), sizeof index_));
+        index_changed = false;
+      }
+      return true;
+    };
+
+    for (size_t i = 0; i < count; i++) {
+      const LogRecord &log = records[i];
+      time_t timestamp = log.timestamp;
+      struct tm tm;
+      localtime_r(&timestamp, &tm);
+      char day[16];
+      strftime(day, sizeof day, "%Y-%m-%d", &tm);
+      if (curday != day) {
+        if (!flush()) {
+          return first;
+        }
+        first = i;
+        curday = day;
+        create_log_dir_(curday);
+        open_log_index_(curday);
+      }
+      if (index_[tm.tm_hour] == LOG_INDEX_UNSET) {
+        index_[tm.tm_hour] = index_records_;
+        index_changed = true;
+      }
+
+      BinaryLogRecord record{};
+      record.timestamp = log.timestamp;
+      record.result = log.result;
+      record.mark = LOG_RECORD_MARK;
+      std::string_view text;
+      if (log.result == LOG_MESSAGE) {
+        text = log.message();
+      } else {
+        record.key_hash = fnv1a_hash(log.key().data(), log.key().length());
+        if (log.result == LOG_DENIED) {
+          text = log.key();
+        } else {
+          // the name as of the check, the list may have changed by the time the log is read
+          granted.assign(log.name().data(), log.name().length());
+          granted += ": ";
+          granted.append(log.key().data(), log.key().length());
+          text = granted;
+        }
+      }
+      record.extra = (text.length() + sizeof record - 1) / sizeof record;
+      record.length = text.length();
+      content.append(reinterpret_cast<const char*>(&record), sizeof record);
+      size_t text_start = content.length();
+      content.append(text.data(), text.length());
+      // keeps the mark unique and the rendered log one line per entry
+      std::replace_if(content.begin() + text_start, content.end(), [](char c) -> bool { return (uint8_t) c < 0x20; }, ' ');
+      content.append(record.extra * sizeof record - text.length(), '\0');
+      index_records_ += 1 + record.extra;
     }
-    if (!sdfs_->write_file("/" + path_ + "/acl.csv", data)) {
-      ESP_LOGE(TAG, "Error saving acl.csv file");
+    return flush() ? count : first;
+  }
+
+  void AclStore::open_log_index_(const std::string &day) {
+    if (index_day_ == day) {
+      return;
+    }
+    index_day_ = day;
+    std::fill(index_, index_ + LOG_HOURS, LOG_INDEX_UNSET);
+    index_records_ = 0;
+    const std::string base = log_path_(day, "");
+    optional<sdmmc::FileInfo> info = sdfs_->file_info(base + ".bin");
+    if (!info.has_value()) {
+      return;
+    }
+    if (info.value().size % sizeof(BinaryLogRecord) != 0) {
+      // pad a torn append so that new records start on a record boundary again
+      size_t pad = sizeof(BinaryLogRecord) - info.value().size % sizeof(BinaryLogRecord);
+      sdfs_->append_file(base + ".bin", std::string(pad, '\0'));
+    }
+    index_records_ = (info.value().size + sizeof(BinaryLogRecord) - 1) / sizeof(BinaryLogRecord);
+    if (sdfs_->exists(base + ".idx")) {
+      size_t read = 0;
+      sdfs_->read_file(base + ".idx", [this, &read](const char *data, const size_t length) -> bool {
+        size_t n = std::min(length, sizeof index_ - read);
+        memcpy(reinterpret_cast<char*>(index_) + read, data, n);
+        read += n;
+        return read < sizeof index_;
+      });
     }
   }
 
-  optional<std::string> AclStore::find_latest_log_() {
+  bool AclStore::read_binary_log(const std::string &day, uint8_t from_hour, uint8_t to_hour,
+                                 std::function<bool(const BinaryLogRecord&, std::string_view)> callback) {
     if (sdfs_ == nullptr) {
-      return {};
+      return false;
     }
-    optional<std::string> result = {};
-    sdfs_->list_dir("/" + path_ + "/logs", [&result](const std::string &name) -> bool {
-      if (!result.has_value() || result.value().compare(name) < 0) {
-        result = name;
+    if (!has_binary_log(day)) {
+      return false;
+    }
+
+    // the index is only a shortcut, without it the day is scanned from the start;
+    // it is dropped when a day is compressed
+    const std::string base = log_path_(day, "");
+    uint32_t index[LOG_HOURS];
+    std::fill(index, index + LOG_HOURS, LOG_INDEX_UNSET);
+    if (!sdfs_->exists(base + ".bin.gz") && sdfs_->exists(base + ".idx")) {
+      size_t read = 0;
+      sdfs_->read_file(base + ".idx", [&index, &read](const char *data, const size_t length) -> bool {
+        size_t n = std::min(length, sizeof index - read);
+        memcpy(reinterpret_cast<char*>(index) + read, data, n);
+        read += n;
+        return read < sizeof index;
+      });
+      if (read < sizeof index) {
+        std::fill(index, index + LOG_HOURS, LOG_INDEX_UNSET);
       }
+    }
+    uint32_t start = 0;
+    for (size_t hour = from_hour; hour < LOG_HOURS; hour++) {
+      if (index[hour] != LOG_INDEX_UNSET) {
+        start = index[hour];
+        break;
+      }
+    }
+
+    read_binary_records_(day, start, from_hour, to_hour, callback);
+    return true;
+  }
+
+  bool AclStore::read_binary_log_tail(const std::string &day, size_t count,
+                                      std::function<bool(const BinaryLogRecord&, std::string_view)> callback) {
+    if (sdfs_ == nullptr || !is_valid_day(day)) {
+      return false;
+    }
+    const std::string path = log_path_(day, ".bin");
+    if (sdfs_->exists(path + ".gz")) {
+      // a compressed day can only be decoded from the start, once to count its entries and once to send the last ones
+      size_t total = 0;
+      read_binary_records_(day, 0, 0, LOG_HOURS - 1, [&total](const BinaryLogRecord &record, std::string_view text) -> bool {
+        total++;
+        return true;
+      });
+      size_t skip = total > count ? total - count : 0;
+      read_binary_records_(day, 0, 0, LOG_HOURS - 1,
+          [&skip, &callback](const BinaryLogRecord &record, std::string_view text) -> bool {
+        if (skip > 0) {
+          skip--;
+          return true;
+        }
+        return callback(record, text);
+      });
+      return true;
+    }
+    optional<sdmmc::FileInfo> info = sdfs_->file_info(path);
+    if (!info.has_value()) {
+      return false;
+    }
+
+    // walk back over whole records, continuation records never carry the mark
+    const size_t block_records = TAIL_BLOCK_SIZE / sizeof(BinaryLogRecord);
+    BinaryLogRecord block[block_records];
+    size_t end = info->size / sizeof(BinaryLogRecord);
+    size_t start = end;
+    size_t found = 0;
+    while (end > 0 && found < count) {
+      size_t first = end > block_records ? end - block_records : 0;
+      if (!read_block_(path, first * sizeof(BinaryLogRecord), (end - first) * sizeof(BinaryLogRecord),
+                       reinterpret_cast<char*>(block))) {
+        return false;
+      }
+      for (size_t i = end; i > first && found < count; i--) {
+        if (block[i - 1 - first].mark == LOG_RECORD_MARK) {
+          start = i - 1;
+          found++;
+        }
+      }
+      end = first;
+    }
+    if (found > 0) {
+      read_binary_records_(day, start, 0, LOG_HOURS - 1, callback);
+    }
+    return true;
+  }
+
+  bool AclStore::read_text_log_tail(const std::string &day, size_t count, std::function<bool(const char*, const size_t)> callback) {
+    if (sdfs_ == nullptr || !is_valid_day(day)) {
+      return false;
+    }
+    const std::string path = log_path_(day, ".log");
+    if (sdfs_->exists(path + ".gz")) {
+      // counts the lines of a compressed day first, then skips all but the last count of them
+      size_t lines = 0;
+      char last = '\n';
+      read_log_(day, ".log", 0, SIZE_MAX, [&lines, &last](const char *data, const size_t length) -> bool {
+        lines += std::count(data, data + length, '\n');
+        last = data[length - 1];
+        return true;
+      });
+      if (last != '\n') {
+        lines++;
+      }
+      size_t skip = lines > count ? lines - count : 0;
+      return read_log_(day, ".log", 0, SIZE_MAX, [&skip, &callback](const char *data, const size_t length) -> bool {
+        const char *start = data;
+        const char *end = data + length;
+        while (skip > 0 && start < end) {
+          const char *newline = static_cast<const char*>(memchr(start, '\n', end - start));
+          if (newline == nullptr) {
+            return true;
+          }
+          start = newline + 1;
+          skip--;
+        }
+        return start == end || callback(start, end - start);
+      });
+    }
+    optional<sdmmc::FileInfo> info = sdfs_->file_info(path);
+    if (!info.has_value()) {
+      return false;
+    }
+
+    char block[TAIL_BLOCK_SIZE];
+    size_t end = info->size;
+    size_t start = 0;
+    size_t found = 0;
+    while (end > 0 && start == 0) {
+      size_t first = end > sizeof block ? end - sizeof block : 0;
+      if (!read_block_(path, first, end - first, block)) {
+        return false;
+      }
+      for (size_t i = end; i > first; i--) {
+        // the newline that ends the last line does not start another one
+        if (block[i - 1 - first] == '\n' && i != info->size && ++found == count) {
+          start = i;
+          break;
+        }
+      }
+      end = first;
+    }
+    return sdfs_->read_file(path, start, SIZE_MAX, callback);
+  }
+
+  bool AclStore::read_block_(const std::string &path, size_t offset, size_t length, char *buffer) {
+    size_t read = 0;
+    sdfs_->read_file(path, offset, length, [buffer, &read](const char *data, const size_t length) -> bool {
+      memcpy(buffer + read, data, length);
+      read += length;
       return true;
     });
-    return result;
+    return read == length;
   }
 
-  optional<std::string> AclStore::load_log_content(const std::string &period) {
+  void AclStore::read_binary_records_(const std::string &day, size_t start, uint8_t from_hour, uint8_t to_hour,
+                                      std::function<bool(const BinaryLogRecord&, std::string_view)> callback) {
+    BinaryLogRecord record{};
+    size_t record_read = 0;
+    std::string text;
+    read_log_(day, ".bin", start * sizeof record, SIZE_MAX, [&](const char *data, const size_t length) -> bool {
+      size_t i = 0;
+      while (i < length) {
+        if (record_read < sizeof record) {
+          size_t n = std::min(length - i, sizeof record - record_read);
+          memcpy(reinterpret_cast<char*>(&record) + record_read, data + i, n);
+          record_read += n;
+          i += n;
+          text.clear();
+          if (record_read < sizeof record) {
+            break;
+          }
+        } else {
+          // continuation records of a denied key or message
+          size_t total = record.extra * sizeof record;
+          size_t n = std::min(length - i, total - (record_read - sizeof record));
+          text.append(data + i, n);
+          record_read += n;
+          i += n;
+        }
+        if (record_read < sizeof record + record.extra * sizeof record) {
+          continue;
+        }
+        record_read = 0;
+        if (record.timestamp == 0 || record.result > LOG_MESSAGE) {
+          continue;
+        }
+        time_t timestamp = record.timestamp;
+        struct tm tm;
+        localtime_r(&timestamp, &tm);
+        if (tm.tm_hour < from_hour) {
+          continue;
+        }
+        if (tm.tm_hour > to_hour) {
+          return false;
+        }
+        if (!callback(record, std::string_view(text.data(), std::min<size_t>(record.length, text.length())))) {
+          return false;
+        }
+      }
+      return true;
+    });
+  }
+
+  optional<std::string> AclStore::find_latest_log_() {
     if (sdfs_ == nullptr) {
       return {};
     }
+    // only the newest month with logs is listed, plus any day not yet moved out of the flat layout
+    const std::string root = "/" + path_ + "/logs";
+    optional<std::string> result = {};
+    auto newest = [&result](const std::string &name) -> bool {
+      std::string day;
+      uint8_t files;
+      if (parse_log_name_(name, day, files) && (!result.has_value() || result.value().compare(day) < 0)) {
+        result = day;
+      }
+      return true;
+    };
+    sdfs_->list_dir(root, newest);
+    optional<std::string> flat = result;
+    for (const std::string &year: list_numbered_(sdfs_, root, 4)) {
+      for (const std::string &month: list_numbered_(sdfs_, root + "/" + year, 2)) {
+        result = {};
+        sdfs_->list_dir(root + "/" + year + "/" + month, newest);
+        if (result.has_value()) {
+          return flat.has_value() && flat.value().compare(result.value()) > 0 ? flat : result;
+        }
+      }
+    }
+    return flat;
+  }
 
-    std::string fname;
+  optional<std::string> AclStore::resolve_log_day(const std::string &period) {
     if (period == "latest") {
-      optional<std::string> latest = find_latest_log_();
-      if (!latest.has_value()) {
-        return latest;
+      return find_latest_log_();
+    }
+    if (!is_valid_day(period)) {
+      return {};
+    }
+    return period;
+  }
+
+  bool AclStore::is_valid_day(const std::string &day) {
+    // exactly YYYY-MM-DD, which also keeps a requested day from leaving logs/
+    if (day.length() != 10) {
+      return false;
+    }
+    for (size_t i = 0; i < 10; i++) {
+      if (i == 4 || i == 7 ? day[i] != '-' : !isdigit((unsigned char) day[i])) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  optional<sdmmc::FileInfo> AclStore::log_info(const std::string &day) {
+    if (sdfs_ == nullptr || !is_valid_day(day)) {
+      return {};
+    }
+    optional<sdmmc::FileInfo> res;
+    for (const char *ext: {".bin", ".log", ".bin.gz", ".log.gz"}) {
+      auto info = sdfs_->file_info(log_path_(day, ext));
+      if (!info.has_value()) {
+        continue;
+      }
+      if (!res.has_value()) {
+        res = info;
+      } else {
+        res->size += info->size;
+        res->mtime = std::max(res->mtime, info->mtime);
+      }
+    }
+    return res;
+  }
+
+  bool AclStore::has_text_log(const std::string &day) {
+    return sdfs_ != nullptr && is_valid_day(day) && (sdfs_->exists(log_path_(day, ".log")) || sdfs_->exists(log_path_(day, ".log.gz")));
+  }
+
+  bool AclStore::has_binary_log(const std::string &day) {
+    return sdfs_ != nullptr && is_valid_day(day) && (sdfs_->exists(log_path_(day, ".bin")) || sdfs_->exists(log_path_(day, ".bin.gz")));
+  }
+
+  bool AclStore::read_text_log(const std::string &day, size_t offset, size_t length,
+                               std::function<bool(const char*, const size_t)> callback) {
+    if (sdfs_ == nullptr || !is_valid_day(day)) {
+      return false;
+    }
+    return read_log_(day, ".log", offset, length, callback);
+  }
+
+  bool AclStore::text_log_archived(const std::string &day) {
+    return sdfs_ != nullptr && is_valid_day(day) && sdfs_->exists(log_path_(day, ".log.gz"));
+  }
+
+  bool AclStore::read_text_log_archive(const std::string &day, std::function<bool(const char*, const size_t)> callback) {
+    if (!text_log_archived(day) || sdfs_->exists(log_path_(day, ".log"))) {
+      return false;
+    }
+    return sdfs_->read_file(log_path_(day, ".log.gz"), callback);
+  }
+
+  std::string AclStore::log_path_(const std::string &day, const char *ext) const {
+    // logs/YYYY/MM/YYYY-MM-DD.ext keeps every directory small; callers pass days checked by is_valid_day()
+    return "/" + path_ + "/logs/" + day.substr(0, 4) + "/" + day.substr(5, 2) + "/" + day + ext;
+  }
+
+  void AclStore::create_log_dir_(const std::string &day) {
+    if (!is_valid_day(day.substr(0, 10))) {
+      return;
+    }
+    std::string month = day.substr(0, 4) + "/" + day.substr(5, 2);
+    if (log_dir_ == month) {
+      return;
+    }
+    for (const std::string &dir: {"/" + path_, "/" + path_ + "/logs", "/" + path_ + "/logs/" + day.substr(0, 4),
+                                  "/" + path_ + "/logs/" + month}) {
+      if (!sdfs_->is_directory(dir) && !sdfs_->create_dir(dir)) {
+        return;
       }
-      fname = latest.value();
+    }
+    log_dir_ = month;
+  }
+
+  bool AclStore::parse_log_name_(const std::string &name, std::string &day, uint8_t &files) {
+    // YYYY-MM-DD followed by .log, .bin, .idx, .log.gz or .bin.gz
+    if (name.length() < 14 || !is_valid_day(name.substr(0, 10))) {
+      return false;
+    }
+    std::string ext = name.substr(10);
+    if (ext == ".log") {
+      files = LOG_FILE_TEXT;
+    } else if (ext == ".bin") {
+      files = LOG_FILE_BINARY;
+    } else if (ext == ".log.gz") {
+      files = LOG_FILE_TEXT_ARCHIVE;
+    } else if (ext == ".bin.gz") {
+      files = LOG_FILE_BINARY_ARCHIVE;
+    } else if (ext == ".idx") {
+      files = 0;
     } else {
-      fname = period + ".log";
+      return false;
     }
-    return sdfs_->read_file_string("/" + path_ + "/logs/" + fname);
+    day = name.substr(0, 10);
+    return true;
   }
 
+  std::vector<std::string> AclStore::list_numbered_(sdmmc::SdFs *sdfs, const std::string &path, size_t digits) {
+    // year or month directories, newest first
+    std::vector<std::string> res;
+    sdfs->list_dir(path, [&res, digits](const std::string &name) -> bool {
+      if (name.length() == digits && std::all_of(name.begin(), name.end(), ::isdigit)) {
+        res.push_back(name);
+      }
+      return true;
+    });
+    std::sort(res.rbegin(), res.rend());
+    return res;
+  }
+
+  bool AclStore::read_log_(const std::string &day, const char *ext, size_t offset, size_t length,
+                           std::function<bool(const char*, const size_t)> callback) {
+    if (!is_valid_day(day)) {
+      return false;
+    }
+    const std::string path = log_path_(day, ext);
+    bool archived = sdfs_->exists(path + ".gz");
+    bool raw = sdfs_->exists(path);
+    if (!archived && !raw) {
+      return false;
+    }
+    // a day reads as its archive followed by anything logged to it after it was compressed
+    bool more = true;
+    if (archived) {
+      sdfs_->read_file(path + ".gz", [&](const sdmmc::SdFs::Reader &reader) -> bool {
+        GzipDecoder decoder(reader, [&](const char *data, const size_t size) -> bool {
+          if (offset >= size) {
+            offset -= size;
+            return true;
+          }
+          size_t n = std::min(size - offset, length);
+          more = callback(data + offset, n);
+          offset = 0;
+          length -= n;
+          more = more && length > 0;
+          return more;
+        });
+        if (!decoder.run() && more) {
+          if (decoder.out_of_memory()) {
+            ESP_LOGW(TAG, "Not enough memory to read %s.gz", path.c_str());
+          } else {
+            ESP_LOGW(TAG, "Damaged log archive %s.gz", path.c_str());
+          }
+        }
+        return true;
+      });
+    }
+    if (raw && more && length > 0) {
+      sdfs_->read_file(path, offset, length, callback);
+    }
+    return true;
+  }
+
+  bool AclStore::maintain_logs(time_t now) {
+    if (sdfs_ == nullptr) {
+      return false;
+    }
+    if (archive_) {
+      archive_step_();
+      return true;
+    }
+    if (!log_days_scanned_) {
+      log_days_scanned_ = scan_logs_();
+      return true;
+    }
+
+    struct tm tm;
+    localtime_r(&now, &tm);
+    char today[16];
+    strftime(today, sizeof today, "%Y-%m-%d", &tm);
+    time_t oldest_time = now - (time_t) log_max_age_ * 24 * 3600;
+    localtime_r(&oldest_time, &tm);
+    char oldest[16];
+    strftime(oldest, sizeof oldest, "%Y-%m-%d", &tm);
+    size_t total = 0;
+    for (auto const& day: log_days_) {
+      total += day.size;
+    }
+
+    // log_days_ is sorted, the current day is never deleted or compressed
+    if (!log_days_.empty() && log_days_.front().day < today &&
+        ((log_max_age_ > 0 && log_days_.front().day < oldest) || (log_max_size_ > 0 && total > log_max_size_))) {
+      ESP_LOGI(TAG, "Deleting logs of %s", log_days_.front().day.c_str());
+      delete_log_day_(log_days_.front().day);
+      log_days_.erase(log_days_.begin());
+      return true;
+    }
+    if (log_compress_) {
+      for (auto &day: log_days_) {
+        if (day.day >= today) {
+          break;
+        }
+        // a day already compressed is left alone if something was logged to it afterwards
+        if ((day.files & LOG_FILE_TEXT) && !(day.files & LOG_FILE_TEXT_ARCHIVE)) {
+          day.files |= LOG_FILE_TEXT_ARCHIVE;
+          start_archive_(day.day, ".log");
+          return true;
+        }
+        if ((day.files & LOG_FILE_BINARY) && !(day.files & LOG_FILE_BINARY_ARCHIVE)) {
+          day.files |= LOG_FILE_BINARY_ARCHIVE;
+          start_archive_(day.day, ".bin");
+          return true;
+        }
+      }
+    }
+    log_days_.clear();
+    log_days_scanned_ = false;
+    return false;
+  }
+
+  bool AclStore::scan_logs_() {
+    const std::string root = "/" + path_ + "/logs";
+    log_days_.clear();
+    if (!sdfs_->is_directory(root)) {
+      return true;
+    }
+
+    // logs of the flat layout are moved into their month directory a few at a time
+    std::vector<std::string> flat;
+    sdfs_->list_dir(root, [&flat](const std::string &name) -> bool {
+      std::string day;
+      uint8_t files;
+      if (parse_log_name_(name, day, files)) {
+        flat.push_back(name);
+      }
+      return flat.size() < MIGRATE_STEP_FILES;
+    });
+    for (const std::string &name: flat) {
+      create_log_dir_(name);
+      sdfs_->rename_file(root + "/" + name, log_path_(name.substr(0, 10), name.c_str() + 10));
+    }
+    if (!flat.empty()) {
+      ESP_LOGI(TAG, "Moved %u log files into logs/YYYY/MM", (unsigned) flat.size());
+      return false;
+    }
+
+    for (const std::string &year: list_numbered_(sdfs_, root, 4)) {
+      for (const std::string &month: list_numbered_(sdfs_, root + "/" + year, 2)) {
+        const std::string dir = root + "/" + year + "/" + month;
+        size_t found = log_days_.size();
+        sdfs_->list_dir(dir, [this, &dir](const std::string &name) -> bool {
+          std::string day;
+          uint8_t files;
+          if (!parse_log_name_(name, day, files)) {
+            return true;
+          }
+          auto it = std::find_if(log_days_.begin(), log_days_.end(), [&day](const LogDay &d) -> bool { return d.day == day; });
+          if (it == log_days_.end()) {
+            log_days_.push_back(LogDay{day, 0, 0});
+            it = log_days_.end() - 1;
+          }
+          optional<sdmmc::FileInfo> info = sdfs_->file_info(dir + "/" + name);
+          it->size += info.has_value() ? info->size : 0;
+          it->files |= files;
+          return true;
+        });
+        if (found == log_days_.size() && dir != root + "/" + log_dir_) {
+          // emptied by retention
+          sdfs_->remove_dir(dir);
+        }
+      }
+    }
+    std::sort(log_days_.begin(), log_days_.end(), [](const LogDay &a, const LogDay &b) -> bool { return a.day < b.day; });
+    return true;
+  }
+
+  void AclStore::start_archive_(const std::string &day, const char *ext) {
+    ESP_LOGD(TAG, "Compressing %s%s", day.c_str(), ext);
+    const std::string part = log_path_(day, ext) + ".part";
+    sdfs_->delete_file(part);
+    archive_ = std::make_unique<LogArchive>();
+    archive_->day = day;
+    archive_->ext = ext;
+    archive_->offset = 0;
+    LogArchive *archive = archive_.get();
+    archive_->encoder = std::make_unique<GzipEncoder>([archive](const char *data, const size_t length) -> bool {
+      archive->output.append(data, length);
+      return true;
+    });
+    if (archive_->encoder->out_of_memory()) {
+      // the day stays as it is until the next maintenance run
+      ESP_LOGW(TAG, "Not enough memory to compress %s%s", day.c_str(), ext);
+      archive_.reset();
+    }
+  }
+
+  void AclStore::archive_step_() {
+    LogArchive &archive = *archive_;
+    const std::string source = log_path_(archive.day, archive.ext);
+    size_t read = 0;
+    bool ok = sdfs_->read_file(source, archive.offset, ARCHIVE_STEP_SIZE, [&archive, &read](const char *data, const size_t length) -> bool {
+      read += length;
+      return archive.encoder->write(data, length);
+    });
+    archive.offset += read;
+    bool done = ok && read < ARCHIVE_STEP_SIZE;
+    if (done) {
+      archive.encoder->finish();
+    }
+    if (ok && !archive.output.empty()) {
+      ok = sdfs_->append_file(source + ".part", archive.output);
+      archive.output.clear();
+    }
+    if (!ok) {
+      ESP_LOGW(TAG, "Unable to compress %s", source.c_str());
+      sdfs_->delete_file(source + ".part");
+      archive_.reset();
+      return;
+    }
+    if (!done) {
+      return;
+    }
+
+    // the archive only takes over once it is complete
+    sdfs_->rename_file(source + ".part", source + ".gz");
+    sdfs_->delete_file(source);
+    if (strcmp(archive.ext, ".bin") == 0) {
+      sdfs_->delete_file(log_path_(archive.day, ".idx"));
+      index_day_.clear();
+    }
+    optional<sdmmc::FileInfo> info = sdfs_->file_info(source + ".gz");
+    ESP_LOGI(TAG, "Compressed %s%s from %u to %u bytes", archive.day.c_str(), archive.ext, (unsigned) archive.offset,
+             info.has_value() ? (unsigned) info->size : 0);
+    auto it = std::find_if(log_days_.begin(), log_days_.end(), [&archive](const LogDay &d) -> bool { return d.day == archive.day; });
+    if (it != log_days_.end() && info.has_value()) {
+      it->size = it->size + info->size - std::min(it->size, archive.offset);
+    }
+    archive_.reset();
+  }
+
+  void AclStore::delete_log_day_(const std::string &day) {
+    for (const char *ext: {".log", ".bin", ".idx", ".log.gz", ".bin.gz", ".log.part", ".bin.part"}) {
+      sdfs_->delete_file(log_path_(day, ext));
+    }
+    if (index_day_ == day) {
+      index_day_.clear();
+    }
+  }
 
 }  // namespace acl
 }  // namespace esphome
@@ -1,55 +1,299 @@
 #pragma once
 
+#include <memory>
 #include <string>
-#include <map>
-#include <list>
 #include <vector>
 
+#include "acl_changes.h"
+#include "acl_log.h"
+#include "acl_table.h"
+#include "gzip.h"
+#include "line_reader.h"
+
 #include "esphome/components/sdmmc/sdfs.h"
 #include "esphome/core/optional.h"
 
 namespace esphome {
 namespace acl {
 
-struct AclEntry {
-  AclEntry(
-    const std::string &_name,
-    const std::string &_key): name(_name), key(_key) {}
-  std::string name;
-  std::string key;
+/// Journal size after which the next loop() folds it back into acl.csv.
+static const size_t JOURNAL_COMPACT_SIZE = 16 * 1024;
+/// Logs are read backwards in blocks of this size to find their last entries.
+static const size_t TAIL_BLOCK_SIZE = 512;
+/// Bytes of a past day compressed per maintain_logs() step.
+static const size_t ARCHIVE_STEP_SIZE = 4096;
+/// Logs of the flat layout moved into their month directory per maintain_logs() step.
+static const size_t MIGRATE_STEP_FILES = 32;
+
+/// Bytes of acl.bin or acl.csv read or written per load_step() or store_step().
+static const size_t LOAD_STEP_SIZE = 4096;
+
+/// Progress of a load run by load_step() or a store run by store_step().
+enum LoadStatus : uint8_t {
+  LOAD_PENDING,
+  LOAD_DONE,
+  LOAD_FAILED,
+  /// A reload found acl.csv as it was last loaded or stored and loaded nothing.
+  LOAD_UNCHANGED,
 };
 
-struct LogEntry {
-  LogEntry(
-    const std::string &_timestamp,
-    const std::string &_message): timestamp(_timestamp), message(_message) {}
-  std::string timestamp;
-  std::string message;
+/// Header of acl.bin, a copy of the table restored at boot instead of parsing acl.csv for as long as the csv keeps
+/// source_size and source_mtime. It is followed by count key hashes (u32) in the order of the records, pool_size
+/// bytes of "key\0name\0" records in the slot order of the table written and a FNV-1a checksum (u32) of the hashes
+/// and records. All words are little endian.
+struct SnapshotHeader {
+  uint32_t magic;
+  uint16_t version;
+  uint16_t header_size;
+  uint32_t count;
+  uint32_t pool_size;
+  uint32_t source_size;
+  uint32_t source_mtime;
+};
+
+/// Restores a table from acl.bin fed in arbitrary chunks, so it can be read a step at a time.
+class SnapshotReader {
+  public:
+    SnapshotReader(const sdmmc::FileInfo &source, size_t size, AclTable &table): source_(source), size_(size), table_(table) {}
+
+    /// Returns false as soon as the snapshot turns out stale or damaged.
+    bool feed(const char *data, size_t length);
+    /// True if the whole snapshot was fed and matched its checksum.
+    bool finish() const;
+
+  protected:
+    sdmmc::FileInfo source_;
+    size_t size_;
+    AclTable &table_;
+    SnapshotHeader header_{};
+    size_t header_read_{0};
+    std::vector<uint32_t> hashes_;
+    /// A hash or the checksum, either may straddle chunks.
+    char word_[4];
+    size_t word_read_{0};
+    size_t pool_read_{0};
+    size_t restored_{0};
+    /// Current "key\0name\0" record, which may straddle chunks.
+    std::string record_;
+    size_t key_length_{std::string::npos};
+    uint32_t checksum_{0};
+
+    bool valid_header_() const;
+};
+
+/// Writes acl.bin for a table a part at a time, so it can be written a step at a time. The table must not change
+/// until the last part is written.
+class SnapshotWriter {
+  public:
+    SnapshotWriter(const sdmmc::FileInfo &source, const AclTable &table);
+
+    /// Appends the next part to output until it holds at least length bytes. Returns false once the last
+    /// part was appended.
+    bool next(std::string &output, size_t length);
+    bool started() const { return started_; }
+
+  protected:
+    const AclTable &table_;
+    SnapshotHeader header_{};
+    bool started_{false};
+    /// Slot of the next hash, or of the next record once the hashes are written.
+    size_t index_{0};
+    bool records_{false};
+    uint32_t checksum_{0};
+};
+
+/// Files found for a day by a log maintenance scan.
+enum LogFileFlags : uint8_t {
+  LOG_FILE_TEXT = 1,
+  LOG_FILE_BINARY = 2,
+  LOG_FILE_TEXT_ARCHIVE = 4,
+  LOG_FILE_BINARY_ARCHIVE = 8,
+};
+
+struct LogDay {
+  std::string day;
+  size_t size;
+  uint8_t files;
 };
 
 class AclStore {
   public:
     void set_sdfs(sdmmc::SdFs *sdfs) { sdfs_ = sdfs; }
     void set_path(const std::string &path) { path_ = path; }
+    void set_log_format(LogFormat format) { log_format_ = format; }
+    LogFormat log_format() const { return log_format_; }
+    /// Days older than max_age_days are deleted, then the oldest ones for as long as all logs take more
+    /// than max_size bytes; 0 disables a limit. Past days are gzip compressed if compress is set.
+    void set_log_retention(uint16_t max_age_days, uint32_t max_size, bool compress) {
+      log_max_age_ = max_age_days;
+      log_max_size_ = max_size;
+      log_compress_ = compress;
+    }
+
+    /// Loads acl.bin if it still matches acl.csv, otherwise parses acl.csv and refreshes acl.bin.
+    /// Changes recorded in acl.journal since the last store are replayed on top.
+    bool load_acl(AclTable &table);
+    /// Starts the same load into a table of its own, which load_step() then runs a step at a time.
+    void load_begin();
+    /// Starts a load that ends with LOAD_UNCHANGED instead if it would load what was loaded last: acl.csv kept its
+    /// size and modification time, or only its time changed and not its hash, and there is neither an upload nor
+    /// a foreign journal write.
+    void reload_begin();
+    /// Reads or hashes LOAD_STEP_SIZE bytes of acl.bin or acl.csv, writes as much of acl.bin or replays the
+    /// journal. On LOAD_DONE the loaded list is moved into table.
+    LoadStatus load_step(AclTable &table);
+    /// Drops a load in progress, for when the list on the card is about to be replaced.
+    void load_cancel() { load_.reset(); }
+    bool loading() const { return load_ != nullptr; }
+
+    /// Rewrites acl.csv and acl.bin from the table and empties the journal.
+    bool store_acl(std::shared_ptr<const AclTable> table);
+    /// Starts the same store, which store_step() then runs a step at a time. The table holds the changes of the
+    /// first journal_size bytes of acl.journal, the ones journaled after are kept.
+    void store_begin(std::shared_ptr<const AclTable> table, size_t journal_size);
+    /// Writes LOAD_STEP_SIZE bytes of acl.csv aside, swaps it in or writes as much of acl.bin.
+    LoadStatus store_step();
+    void store_cancel() { store_.reset(); }
+    bool storing() const { return store_ != nullptr; }
+
+    /// Appends single changes to acl.journal instead of rewriting acl.csv.
+    bool journal_add(std::string_view name, std::string_view key);
+    bool journal_remove(std::string_view key);
+    /// Appends a batch of changes with a single write.
+    bool journal_changes(const std::vector<AclChange> &changes);
+    size_t journal_size() const { return journal_size_; }
+    bool compaction_required() const { return journal_damaged_ || journal_size_ > JOURNAL_COMPACT_SIZE; }
+
+    /// Splits a "name,key" line. Returns false if the line is not a valid entry.
+    static bool parse_acl_line(std::string_view line, AclRecord &record);
+    static bool is_valid_entry(std::string_view name, std::string_view key);
+    static bool is_valid_key(std::string_view key);
 
-    optional<std::list<AclEntry>> load_acl();
-    
-    void store_acl(const std::list<AclEntry> &data);
+    /// Appends the records to the log files. Returns how many of them are stored, those after a failed append
+    /// are not and are passed again.
+    size_t store_logs(const LogRecord *records, size_t count);
 
-    void store_logs(const std::vector<LogEntry> &logs);
+    /// Stages an uploaded acl.csv streamed by the producer; it replaces the current one on the next
+    /// load_acl(). Nothing is staged if the producer returns false.
+    bool store_acl_content(std::function<bool(const sdmmc::SdFs::Writer&)> producer);
 
-    optional<std::string> load_acl_content();
+    /// Combined size and latest modification time of the logs of a day.
+    optional<sdmmc::FileInfo> log_info(const std::string &day);
+    bool has_text_log(const std::string &day);
+    bool has_binary_log(const std::string &day);
+    /// Streams at most length bytes of the text log of a day from offset in chunks.
+    /// Returns false if the day has no text log.
+    bool read_text_log(const std::string &day, size_t offset, size_t length,
+                       std::function<bool(const char*, const size_t)> callback);
 
-    void store_acl_content(const std::string &data);
+    /// Maps "latest" to the newest day with logs, other periods are returned as is if they are a YYYY-MM-DD day.
+    optional<std::string> resolve_log_day(const std::string &period);
+    static bool is_valid_day(const std::string &day);
 
-    optional<std::string> load_log_content(const std::string &period);
+    /// True if the text log of a day has been compressed.
+    bool text_log_archived(const std::string &day);
+    /// Streams the compressed text log of a day as stored, for clients that accept gzip. Returns false
+    /// without calling back if there is none or the day was logged to after it was compressed.
+    bool read_text_log_archive(const std::string &day, std::function<bool(const char*, const size_t)> callback);
+
+    /// Runs one short step of log maintenance: moving logs of the flat layout into logs/YYYY/MM/,
+    /// deleting days past retention or compressing a bit of a day before the one of now.
+    /// Returns false once there is nothing left to do.
+    bool maintain_logs(time_t now);
+
+    /// Decodes binary log records of a day between the given local hours, seeking to the first
+    /// one through the hour index. Returns false if the day has no binary log.
+    bool read_binary_log(const std::string &day, uint8_t from_hour, uint8_t to_hour,
+                         std::function<bool(const BinaryLogRecord&, std::string_view)> callback);
+
+    /// Stream the last count entries of a day. The file is read backwards in TAIL_BLOCK_SIZE
+    /// blocks only until count entries are found, however long the day is.
+    bool read_binary_log_tail(const std::string &day, size_t count,
+                              std::function<bool(const BinaryLogRecord&, std::string_view)> callback);
+    bool read_text_log_tail(const std::string &day, size_t count, std::function<bool(const char*, const size_t)> callback);
 
   private:
     sdmmc::SdFs *sdfs_;
     std::string path_;
+    size_t journal_size_{0};
+    bool journal_damaged_{false};
+    LogFormat log_format_{LOG_FORMAT_TEXT};
+    std::string index_day_;
+    uint32_t index_[LOG_HOURS];
+    uint32_t index_records_{0};
+    /// Month directory of the logs last written, known to exist.
+    std::string log_dir_;
+    uint16_t log_max_age_{0};
+    uint32_t log_max_size_{0};
+    bool log_compress_{true};
+    /// acl.csv as last loaded or stored, the hash is unknown after loading acl.bin.
+    bool acl_loaded_{false};
+    optional<sdmmc::FileInfo> source_;
+    optional<uint32_t> source_hash_;
+
+    struct LogArchive {
+      std::string day;
+      const char *ext;
+      size_t offset;
+      std::unique_ptr<GzipEncoder> encoder;
+      std::string output;
+    };
+    std::vector<LogDay> log_days_;
+    bool log_days_scanned_{false};
+    std::unique_ptr<LogArchive> archive_;
+
+    /// A load in progress: acl.csv is only hashed while verify is set, acl.bin is read while snapshot is set,
+    /// acl.csv while csv is set, then acl.bin is written while writer is set and the journal is replayed.
+    struct AclLoad {
+      optional<sdmmc::FileInfo> source;
+      AclTable table;
+      size_t offset{0};
+      bool unchanged{false};
+      bool verify{false};
+      std::unique_ptr<SnapshotReader> snapshot;
+      std::unique_ptr<LineReader> csv;
+      bool csv_valid{true};
+      uint32_t hash{0};
+      bool parsed{false};
+      std::unique_ptr<SnapshotWriter> writer;
+    };
+    std::unique_ptr<AclLoad> load_;
+
+    /// A store in progress: acl.csv is written to acl.tmp until all slots of the table are, then swapped in
+    /// and acl.bin written while writer is set.
+    struct AclSave {
+      std::shared_ptr<const AclTable> table;
+      size_t journal_size;
+      size_t index{0};
+      size_t offset{0};
+      uint32_t hash{0};
+      std::unique_ptr<SnapshotWriter> writer;
+    };
+    std::unique_ptr<AclSave> store_;
+
+    std::string log_path_(const std::string &day, const char *ext) const;
+    void create_log_dir_(const std::string &day);
+    static bool parse_log_name_(const std::string &name, std::string &day, uint8_t &files);
+    static std::vector<std::string> list_numbered_(sdmmc::SdFs *sdfs, const std::string &path, size_t digits);
+    bool read_log_(const std::string &day, const char *ext, size_t offset, size_t length,
+                   std::function<bool(const char*, const size_t)> callback);
+    bool scan_logs_();
+    void start_archive_(const std::string &day, const char *ext);
+    void archive_step_();
+    void delete_log_day_(const std::string &day);
     optional<std::string> find_latest_log_();
-    bool load_acl_from_string_(const std::string &str, std::list<AclEntry> &data);
-    bool load_acl_entry_(const std::string &str, std::list<AclEntry> &data);
+    size_t store_text_logs_(const LogRecord *records, size_t count);
+    size_t store_binary_logs_(const LogRecord *records, size_t count);
+    void open_log_index_(const std::string &day);
+    void read_binary_records_(const std::string &day, size_t start, uint8_t from_hour, uint8_t to_hour,
+                              std::function<bool(const BinaryLogRecord&, std::string_view)> callback);
+    bool read_block_(const std::string &path, size_t offset, size_t length, char *buffer);
+    void load_csv_begin_(AclLoad &load);
+    void replay_journal_(AclTable &table);
+    void trim_journal_(size_t offset);
+    void install_upload_();
+    bool append_journal_(const std::string &record);
+    bool write_snapshot_step_(SnapshotWriter &writer);
 };
 
 }  // namespace acl
@@ -0,0 +1,353 @@
+#include "acl_table.h"
+#include "util.h"
+
+#include <cstring>
+
+namespace esphome {
+namespace acl {
+
+size_t AclTable::capacity_for_(size_t count) {
+  size_t capacity = MIN_CAPACITY;
+  while (capacity * 3 < count * 4) {
+    capacity <<= 1;
+  }
+  return capacity;
+}
+
+void AclTable::reserve(size_t count, size_t pool_bytes) {
+  size_t capacity = capacity_for_(count);
+  if (capacity > slots_.size()) {
+    rehash_(capacity);
+  }
+  if (pool_bytes > pool_.capacity()) {
+    pool_.reserve(pool_bytes);
+  }
+}
+
+void AclTable::clear() {
+  std::vector<Slot>().swap(slots_);
+  std::string().swap(pool_);
+  size_ = 0;
+  tombstones_ = 0;
+  garbage_ = 0;
+  text_size_ = 0;
+  std::vector<NameSlot>().swap(name_slots_);
+  std::string().swap(names_);
+  name_count_ = 0;
+  name_tombstones_ = 0;
+  name_garbage_ = 0;
+}
+
+bool AclTable::insert(std::string_view name, std::string_view key) {
+  if ((size_ + tombstones_ + 1) * 4 > slots_.size() * 3) {
+    rehash_(capacity_for_(size_ + 1));
+  }
+
+  uint32_t hash = fnv1a_hash(key.data(), key.size());
+  size_t mask = slots_.size() - 1;
+  size_t target = SIZE_MAX;
+  for (size_t i = hash & mask;; i = (i + 1) & mask) {
+    Slot &slot = slots_[i];
+    if (slot.offset == EMPTY) {
+      if (target == SIZE_MAX) {
+        target = i;
+      }
+      break;
+    }
+    if (slot.offset == TOMBSTONE) {
+      if (target == SIZE_MAX) {
+        target = i;
+      }
+      continue;
+    }
+    if (slot.hash == hash && key_equals_(slot.offset, key)) {
+      if (record_(slot.offset).name == name) {
+        return false;
+      }
+      // renamed in place, the record only moves to the chain of its new name
+      text_size_ += name.size() - record_(slot.offset).name.size();
+      unlink_(slot.offset);
+      link_(slot.offset, intern_(name));
+      if (name_garbage_ > names_.size() / 2) {
+        compact_names_();
+      }
+      return false;
+    }
+  }
+
+  if (slots_[target].offset == TOMBSTONE) {
+    tombstones_--;
+  }
+  slots_[target].hash = hash;
+  slots_[target].offset = append_record_(name, key);
+  size_++;
+  return true;
+}
+
+bool AclTable::erase(std::string_view key) {
+  size_t index = find_slot_(fnv1a_hash(key.data(), key.size()), key);
+  if (index == SIZE_MAX) {
+    return false;
+  }
+  uint32_t offset = slots_[index].offset;
+  garbage_ += RECORD_HEADER + key.size() + 1;
+  text_size_ -= key.size() + record_(offset).name.size() + 2;
+  unlink_(offset);
+  slots_[index].offset = TOMBSTONE;
+  size_--;
+  tombstones_++;
+  if (garbage_ > pool_.size() / 2) {
+    compact_pool_();
+  }
+  if (name_garbage_ > names_.size() / 2) {
+    compact_names_();
+  }
+  return true;
+}
+
+optional<AclRecord> AclTable::find(std::string_view key) const {
+  size_t index = find_slot_(fnv1a_hash(key.data(), key.size()), key);
+  if (index == SIZE_MAX) {
+    return {};
+  }
+  return record_(slots_[index].offset);
+}
+
+optional<AclRecord> AclTable::find_hash(uint32_t hash) const {
+  if (slots_.empty()) {
+    return {};
+  }
+  optional<AclRecord> res;
+  size_t mask = slots_.size() - 1;
+  for (size_t i = hash & mask; slots_[i].offset != EMPTY; i = (i + 1) & mask) {
+    if (slots_[i].offset != TOMBSTONE && slots_[i].hash == hash) {
+      if (res.has_value()) {
+        return {};
+      }
+      res = record_(slots_[i].offset);
+    }
+  }
+  return res;
+}
+
+void AclTable::restore_begin(size_t count, size_t pool_bytes) {
+  clear();
+  reserve(count, pool_bytes);
+}
+
+void AclTable::restore_record(uint32_t hash, std::string_view name, std::string_view key) {
+  if ((size_ + 1) * 4 > slots_.size() * 3) {
+    rehash_(capacity_for_(size_ + 1));
+  }
+  size_t mask = slots_.size() - 1;
+  size_t i = hash & mask;
+  while (slots_[i].offset != EMPTY) {
+    i = (i + 1) & mask;
+  }
+  slots_[i] = Slot{hash, append_record_(name, key)};
+  size_++;
+}
+
+AclRecord AclTable::record_(uint32_t offset) const {
+  const char *key = pool_.data() + offset + RECORD_HEADER;
+  const char *name = names_.data() + header_(offset, 0);
+  return AclRecord{std::string_view(name, std::strlen(name)), std::string_view(key, std::strlen(key))};
+}
+
+uint32_t AclTable::header_(uint32_t offset, size_t field) const {
+  uint32_t value;
+  std::memcpy(&value, pool_.data() + offset + field * sizeof value, sizeof value);
+  return value;
+}
+
+void AclTable::set_header_(uint32_t offset, size_t field, uint32_t value) {
+  std::memcpy(&pool_[offset + field * sizeof value], &value, sizeof value);
+}
+
+bool AclTable::key_equals_(uint32_t offset, std::string_view key) const {
+  const char *stored = pool_.data() + offset + RECORD_HEADER;
+  return std::strncmp(stored, key.data(), key.size()) == 0 && stored[key.size()] == '\0';
+}
+
+size_t AclTable::find_slot_(uint32_t hash, std::string_view key) const {
+  if (slots_.empty()) {
+    return SIZE_MAX;
+  }
+  size_t mask = slots_.size() - 1;
+  for (size_t i = hash & mask;; i = (i + 1) & mask) {
+    const Slot &slot = slots_[i];
+    if (slot.offset == EMPTY) {
+      return SIZE_MAX;
+    }
+    if (slot.offset != TOMBSTONE && slot.hash == hash && key_equals_(slot.offset, key)) {
+      return i;
+    }
+  }
+}
+
+size_t AclTable::find_name_(std::string_view name) const {
+  if (name_slots_.empty()) {
+    return SIZE_MAX;
+  }
+  uint32_t hash = fnv1a_hash(name.data(), name.size());
+  size_t mask = name_slots_.size() - 1;
+  for (size_t i = hash & mask;; i = (i + 1) & mask) {
+    const NameSlot &slot = name_slots_[i];
+    if (slot.offset == EMPTY) {
+      return SIZE_MAX;
+    }
+    if (slot.offset != TOMBSTONE && slot.hash == hash) {
+      const char *stored = names_.data() + slot.offset;
+      if (std::strncmp(stored, name.data(), name.size()) == 0 && stored[name.size()] == '\0') {
+        return i;
+      }
+    }
+  }
+}
+
+size_t AclTable::intern_(std::string_view name) {
+  size_t index = find_name_(name);
+  if (index != SIZE_MAX) {
+    return index;
+  }
+  if ((name_count_ + name_tombstones_ + 1) * 4 > name_slots_.size() * 3) {
+    rehash_names_(capacity_for_(name_count_ + 1));
+  }
+  uint32_t hash = fnv1a_hash(name.data(), name.size());
+  size_t mask = name_slots_.size() - 1;
+  size_t i = hash & mask;
+  while (name_slots_[i].offset < TOMBSTONE) {
+    i = (i + 1) & mask;
+  }
+  if (name_slots_[i].offset == TOMBSTONE) {
+    name_tombstones_--;
+  }
+  name_slots_[i] = NameSlot{hash, (uint32_t) names_.size(), EMPTY, 0};
+  names_.append(name.data(), name.size());
+  names_.push_back('\0');
+  name_count_++;
+  return i;
+}
+
+void AclTable::link_(uint32_t offset, size_t name) {
+  NameSlot &slot = name_slots_[name];
+  set_header_(offset, 0, slot.offset);
+  set_header_(offset, 1, slot.first);
+  slot.first = offset;
+  slot.count++;
+}
+
+void AclTable::unlink_(uint32_t offset) {
+  size_t index = find_name_(record_(offset).name);
+  NameSlot &slot = name_slots_[index];
+  if (slot.first == offset) {
+    slot.first = next_(offset);
+  } else {
+    uint32_t prev = slot.first;
+    while (next_(prev) != offset) {
+      prev = next_(prev);
+    }
+    set_header_(prev, 1, next_(offset));
+  }
+  if (--slot.count == 0) {
+    // the name goes with its last entry
+    name_garbage_ += std::strlen(names_.data() + slot.offset) + 1;
+    slot.offset = TOMBSTONE;
+    name_count_--;
+    name_tombstones_++;
+  }
+}
+
+uint32_t AclTable::append_record_(std::string_view name, std::string_view key) {
+  // interned first, a rehash of the names must not run between finding the slot and linking to it
+  size_t index = intern_(name);
+  uint32_t offset = pool_.size();
+  pool_.append(RECORD_HEADER, '\0');
+  pool_.append(key.data(), key.size());
+  pool_.push_back('\0');
+  text_size_ += key.size() + name.size() + 2;
+  link_(offset, index);
+  return offset;
+}
+
+void AclTable::rehash_(size_t capacity) {
+  std::vector<Slot> old;
+  old.swap(slots_);
+  slots_.assign(capacity, Slot{0, EMPTY});
+  size_t mask = capacity - 1;
+  for (auto const& slot: old) {
+    if (slot.offset >= TOMBSTONE) {
+      continue;
+    }
+    size_t i = slot.hash & mask;
+    while (slots_[i].offset != EMPTY) {
+      i = (i + 1) & mask;
+    }
+    slots_[i] = slot;
+  }
+  tombstones_ = 0;
+}
+
+void AclTable::rehash_names_(size_t capacity) {
+  std::vector<NameSlot> old;
+  old.swap(name_slots_);
+  name_slots_.assign(capacity, NameSlot{0, EMPTY, EMPTY, 0});
+  size_t mask = capacity - 1;
+  for (auto const& slot: old) {
+    if (slot.offset >= TOMBSTONE) {
+      continue;
+    }
+    size_t i = slot.hash & mask;
+    while (name_slots_[i].offset != EMPTY) {
+      i = (i + 1) & mask;
+    }
+    name_slots_[i] = slot;
+  }
+  name_tombstones_ = 0;
+}
+
+void AclTable::compact_pool_() {
+  std::string pool;
+  pool.reserve(pool_.size() - garbage_);
+  for (auto &name: name_slots_) {
+    name.first = EMPTY;
+  }
+  // chains are rebuilt as the records are copied, the names are still found in the old pool
+  for (auto &slot: slots_) {
+    if (slot.offset >= TOMBSTONE) {
+      continue;
+    }
+    AclRecord record = record_(slot.offset);
+    NameSlot &name = name_slots_[find_name_(record.name)];
+    uint32_t header[2] = {name.offset, name.first};
+    uint32_t offset = pool.size();
+    pool.append(reinterpret_cast<const char*>(header), RECORD_HEADER);
+    pool.append(record.key.data(), record.key.size() + 1);
+    name.first = offset;
+    slot.offset = offset;
+  }
+  pool_.swap(pool);
+  garbage_ = 0;
+}
+
+void AclTable::compact_names_() {
+  std::string names;
+  names.reserve(names_.size() - name_garbage_);
+  for (auto &name: name_slots_) {
+    if (name.offset >= TOMBSTONE) {
+      continue;
+    }
+    uint32_t offset = names.size();
+    const char *stored = names_.data() + name.offset;
+    names.append(stored, std::strlen(stored) + 1);
+    for (uint32_t record = name.first; record != EMPTY; record = next_(record)) {
+      set_header_(record, 0, offset);
+    }
+    name.offset = offset;
+  }
+  names_.swap(names);
+  name_garbage_ = 0;
+}
+
+}  // namespace acl
+}  // namespace esphome
@@ -0,0 +1,128 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "esphome/core/optional.h"
+
+namespace esphome {
+namespace acl {
+
+/// View of a single entry inside an AclTable. Both views point into the table's
+/// string pool, are NUL terminated and stay valid until the table is modified.
+struct AclRecord {
+  std::string_view name;
+  std::string_view key;
+};
+
+/// Open addressing hash table of ACL entries keyed by key.
+///
+/// Keys are kept back to back in a single pool as "name, next, key\0" records and
+/// slots only hold the key hash and the record offset in that pool, so an entry
+/// costs 8 bytes of slot and 8 bytes of record header plus its key instead of a
+/// tree node with two heap allocated strings. Names are interned in a second pool,
+/// a person with several credentials is stored once. A small hash table of names
+/// links all records of a name, so they are found without scanning the table.
+class AclTable {
+  public:
+    void reserve(size_t count, size_t pool_bytes = 0);
+    void clear();
+    size_t size() const { return size_; }
+    bool empty() const { return size_ == 0; }
+    size_t capacity() const { return slots_.size(); }
+    size_t pool_size() const { return pool_.size() + names_.size(); }
+    /// Characters of all keys and names with a NUL each, counting a name once per entry.
+    size_t text_size() const { return text_size_; }
+    size_t name_count() const { return name_count_; }
+    size_t memory_usage() const {
+      return slots_.capacity() * sizeof(Slot) + pool_.capacity() + name_slots_.capacity() * sizeof(NameSlot) + names_.capacity();
+    }
+
+    /// Adds an entry or replaces the name of an existing key. Returns true if the key was not present before.
+    bool insert(std::string_view name, std::string_view key);
+    bool erase(std::string_view key);
+    optional<AclRecord> find(std::string_view key) const;
+    /// Looks an entry up by key hash alone. Empty if no entry or more than one entry has that hash.
+    optional<AclRecord> find_hash(uint32_t hash) const;
+
+    template<typename F> void for_each(F callback) const {
+      for (auto const& slot: slots_) {
+        if (slot.offset < TOMBSTONE) {
+          callback(record_(slot.offset));
+        }
+      }
+    }
+
+    /// Calls back with every entry of a name, newest first.
+    template<typename F> void for_each_of(std::string_view name, F callback) const {
+      size_t index = find_name_(name);
+      if (index == SIZE_MAX) {
+        return;
+      }
+      for (uint32_t offset = name_slots_[index].first; offset != EMPTY; offset = next_(offset)) {
+        callback(record_(offset));
+      }
+    }
+
+    /// Slot level access used to persist the table as a binary snapshot.
+    bool slot_used(size_t index) const { return slots_[index].offset < TOMBSTONE; }
+    uint32_t slot_hash(size_t index) const { return slots_[index].hash; }
+    AclRecord slot_record(size_t index) const { return record_(slots_[index].offset); }
+    /// Restores entries of a snapshot, whose keys are known to be unique, without comparing keys.
+    void restore_begin(size_t count, size_t pool_bytes);
+    void restore_record(uint32_t hash, std::string_view name, std::string_view key);
+
+  protected:
+    struct Slot {
+      uint32_t hash;
+      uint32_t offset;
+    };
+    /// first is the record offset of the newest entry of the name, count the number of entries.
+    struct NameSlot {
+      uint32_t hash;
+      uint32_t offset;
+      uint32_t first;
+      uint32_t count;
+    };
+    /// Record header: offset of the name in names_, offset of the next record of the same name.
+    static const size_t RECORD_HEADER = 2 * sizeof(uint32_t);
+
+    static const uint32_t TOMBSTONE = 0xFFFFFFFE;
+    static const uint32_t EMPTY = 0xFFFFFFFF;
+    static const size_t MIN_CAPACITY = 16;
+
+    std::vector<Slot> slots_;
+    std::string pool_;
+    size_t size_{0};
+    size_t tombstones_{0};
+    size_t garbage_{0};
+    size_t text_size_{0};
+
+    std::vector<NameSlot> name_slots_;
+    std::string names_;
+    size_t name_count_{0};
+    size_t name_tombstones_{0};
+    size_t name_garbage_{0};
+
+    static size_t capacity_for_(size_t count);
+    AclRecord record_(uint32_t offset) const;
+    uint32_t header_(uint32_t offset, size_t field) const;
+    void set_header_(uint32_t offset, size_t field, uint32_t value);
+    uint32_t next_(uint32_t offset) const { return header_(offset, 1); }
+    bool key_equals_(uint32_t offset, std::string_view key) const;
+    size_t find_slot_(uint32_t hash, std::string_view key) const;
+    size_t find_name_(std::string_view name) const;
+    size_t intern_(std::string_view name);
+    void link_(uint32_t offset, size_t name);
+    void unlink_(uint32_t offset);
+    uint32_t append_record_(std::string_view name, std::string_view key);
+    void rehash_(size_t capacity);
+    void rehash_names_(size_t capacity);
+    void compact_pool_();
+    void compact_names_();
+};
+
+}  // namespace acl
+}  // namespace esphome
@@ -0,0 +1,496 @@
+#include "gzip.h"
+
+#include <algorithm>
+#include <cstring>
+#include <new>
+
+namespace esphome {
+namespace acl {
+
+static const size_t MIN_MATCH = 3;
+static const size_t MAX_MATCH = 258;
+static const size_t END_OF_BLOCK = 256;
+
+static const uint16_t LENGTH_BASE[] = {3,  4,  5,  6,  7,  8,  9,  10, 11,  13,  15,  17,  19,  23, 27,
+                                       31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258};
+static const uint8_t LENGTH_EXTRA[] = {0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2,
+                                       2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0};
+static const uint16_t DISTANCE_BASE[] = {1,   2,   3,   4,   5,   7,    9,    13,   17,   25,   33,   49,   65,    97,    129,
+                                         193, 257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577};
+static const uint8_t DISTANCE_EXTRA[] = {0, 0, 0, 0, 1, 1, 2, 2,  3,  3,  4,  4,  5,  5,  6,
+                                         6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13};
+static const uint8_t CODE_LENGTH_ORDER[] = {16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15};
+static const uint8_t GZIP_HEADER[] = {0x1f, 0x8b, 8, 0, 0, 0, 0, 0, 0, 0xff};
+
+uint32_t crc32(uint32_t crc, const uint8_t *data, size_t length) {
+  // a nibble table is slower than a byte table but 960 bytes smaller
+  static const uint32_t TABLE[16] = {0x00000000, 0x1DB71064, 0x3B6E20C8, 0x26D930AC, 0x76DC4190, 0x6B6B51F4,
+                                     0x4DB26158, 0x5005713C, 0xEDB88320, 0xF00F9344, 0xD6D6A3E8, 0xCB61B38C,
+                                     0x9B64C2B0, 0x86D3D2D4, 0xA00AE278, 0xBDBDF21C};
+  crc = ~crc;
+  for (size_t i = 0; i < length; i++) {
+    crc ^= data[i];
+    crc = (crc >> 4) ^ TABLE[crc & 15];
+    crc = (crc >> 4) ^ TABLE[crc & 15];
+  }
+  return ~crc;
+}
+
+GzipEncoder::GzipEncoder(Sink sink): sink_(sink) {
+  // a heap too fragmented for the buffers fails the request, not the firmware
+  buffer_.reset(new (std::nothrow) uint8_t[2 * GZIP_WINDOW_SIZE]);
+  head_.reset(new (std::nothrow) uint16_t[GZIP_HASH_SIZE]);
+  if (out_of_memory()) {
+    ok_ = false;
+    return;
+  }
+  std::memset(head_.get(), 0, GZIP_HASH_SIZE * sizeof(uint16_t));
+  output_.reserve(GZIP_OUTPUT_SIZE + 16);
+  output_.append(reinterpret_cast<const char*>(GZIP_HEADER), sizeof GZIP_HEADER);
+  // the whole stream is a single final block with fixed codes
+  put_bits_(1, 1);
+  put_bits_(1, 2);
+}
+
+bool GzipEncoder::write(const char *data, size_t length) {
+  crc_ = crc32(crc_, reinterpret_cast<const uint8_t*>(data), length);
+  size_ += length;
+  while (length > 0 && ok_) {
+    if (length_ == 2 * GZIP_WINDOW_SIZE) {
+      slide_();
+    }
+    size_t n = std::min(length, 2 * GZIP_WINDOW_SIZE - length_);
+    std::memcpy(buffer_.get() + length_, data, n);
+    length_ += n;
+    data += n;
+    length -= n;
+    encode_(false);
+  }
+  return ok_;
+}
+
+bool GzipEncoder::finish() {
+  if (!ok_) {
+    return false;
+  }
+  encode_(true);
+  put_symbol_(END_OF_BLOCK);
+  if (bit_count_ > 0) {
+    put_bits_(0, 8 - bit_count_);
+  }
+  for (uint32_t value: {crc_, size_}) {
+    for (int i = 0; i < 4; i++) {
+      put_byte_(value >> (8 * i));
+    }
+  }
+  flush_output_(1);
+  return ok_;
+}
+
+void GzipEncoder::encode_(bool flush) {
+  // keep enough lookahead for the longest match unless this is the end of the input
+  size_t limit = flush ? length_ : (length_ > MAX_MATCH ? length_ - MAX_MATCH : 0);
+  while (pos_ < limit && ok_) {
+    size_t best = 0;
+    size_t distance = 0;
+    if (length_ - pos_ >= MIN_MATCH) {
+      uint16_t hash = hash_(pos_);
+      size_t candidate = head_[hash];
+      head_[hash] = pos_ + 1;
+      if (candidate > 0) {
+        candidate--;
+        size_t max = std::min(MAX_MATCH, length_ - pos_);
+        const uint8_t *a = buffer_.get() + candidate;
+        const uint8_t *b = buffer_.get() + pos_;
+        while (best < max && a[best] == b[best]) {
+          best++;
+        }
+        distance = pos_ - candidate;
+      }
+    }
+    if (best >= MIN_MATCH) {
+      put_match_(best, distance);
+      for (size_t i = 1; i < best; i++) {
+        if (pos_ + i + MIN_MATCH <= length_) {
+          head_[hash_(pos_ + i)] = pos_ + i + 1;
+        }
+      }
+      pos_ += best;
+    } else {
+      put_symbol_(buffer_[pos_]);
+      pos_++;
+    }
+  }
+}
+
+void GzipEncoder::slide_() {
+  // everything before pos_ is encoded, so only the window behind it has to stay
+  std::memmove(buffer_.get(), buffer_.get() + GZIP_WINDOW_SIZE, GZIP_WINDOW_SIZE);
+  length_ -= GZIP_WINDOW_SIZE;
+  pos_ -= GZIP_WINDOW_SIZE;
+  for (size_t i = 0; i < GZIP_HASH_SIZE; i++) {
+    head_[i] = head_[i] > GZIP_WINDOW_SIZE ? head_[i] - GZIP_WINDOW_SIZE : 0;
+  }
+}
+
+uint16_t GzipEncoder::hash_(size_t pos) const {
+  const uint8_t *p = buffer_.get() + pos;
+  return ((p[0] << 6) ^ (p[1] << 3) ^ p[2]) & (GZIP_HASH_SIZE - 1);
+}
+
+void GzipEncoder::put_bits_(uint32_t value, uint8_t count) {
+  bits_ |= value << bit_count_;
+  bit_count_ += count;
+  while (bit_count_ >= 8) {
+    put_byte_(bits_);
+    bits_ >>= 8;
+    bit_count_ -= 8;
+  }
+}
+
+void GzipEncoder::put_code_(uint32_t code, uint8_t length) {
+  // Huffman codes are packed starting with their most significant bit
+  uint32_t reversed = 0;
+  for (uint8_t i = 0; i < length; i++) {
+    reversed = (reversed << 1) | ((code >> i) & 1);
+  }
+  put_bits_(reversed, length);
+}
+
+void GzipEncoder::put_symbol_(uint16_t symbol) {
+  if (symbol < 144) {
+    put_code_(0x30 + symbol, 8);
+  } else if (symbol < 256) {
+    put_code_(0x190 + symbol - 144, 9);
+  } else if (symbol < 280) {
+    put_code_(symbol - 256, 7);
+  } else {
+    put_code_(0xc0 + symbol - 280, 8);
+  }
+}
+
+void GzipEncoder::put_match_(size_t length, size_t distance) {
+  size_t code = sizeof LENGTH_BASE / sizeof LENGTH_BASE[0] - 1;
+  while (LENGTH_BASE[code] > length) {
+    code--;
+  }
+  put_symbol_(257 + code);
+  put_bits_(length - LENGTH_BASE[code], LENGTH_EXTRA[code]);
+  code = sizeof DISTANCE_BASE / sizeof DISTANCE_BASE[0] - 1;
+  while (DISTANCE_BASE[code] > distance) {
+    code--;
+  }
+  put_code_(code, 5);
+  put_bits_(distance - DISTANCE_BASE[code], DISTANCE_EXTRA[code]);
+}
+
+void GzipEncoder::put_byte_(uint8_t byte) {
+  output_.push_back(byte);
+  flush_output_(GZIP_OUTPUT_SIZE);
+}
+
+void GzipEncoder::flush_output_(size_t min_length) {
+  if (output_.length() < min_length) {
+    return;
+  }
+  ok_ = ok_ && sink_(output_.data(), output_.length());
+  output_.clear();
+}
+
+bool GzipDecoder::run() {
+  window_.reset(new (std::nothrow) uint8_t[INFLATE_WINDOW_SIZE]);
+  if (!window_) {
+    out_of_memory_ = true;
+    return false;
+  }
+  if (!skip_header_()) {
+    return false;
+  }
+  bool last;
+  do {
+    last = bits_in_(1);
+    switch (bits_in_(2)) {
+      case 0:
+        ok_ = ok_ && stored_();
+        break;
+      case 1:
+        ok_ = ok_ && fixed_();
+        break;
+      case 2:
+        ok_ = ok_ && dynamic_();
+        break;
+      default:
+        ok_ = false;
+        break;
+    }
+  } while (!last && ok_);
+  flush_(1);
+
+  // the trailer is byte aligned
+  bits_ = 0;
+  bit_count_ = 0;
+  uint32_t crc = bits_in_(16);
+  crc |= bits_in_(16) << 16;
+  uint32_t size = bits_in_(16);
+  size |= bits_in_(16) << 16;
+  window_.reset();
+  return ok_ && crc == crc_ && size == (uint32_t) written_;
+}
+
+int GzipDecoder::byte_() {
+  if (input_pos_ == input_length_) {
+    int read = ok_ ? source_(input_, sizeof input_) : -1;
+    if (read <= 0) {
+      // the stream ended early or the source failed
+      ok_ = false;
+      return 0;
+    }
+    input_length_ = read;
+    input_pos_ = 0;
+  }
+  return (uint8_t) input_[input_pos_++];
+}
+
+uint32_t GzipDecoder::bits_in_(uint8_t count) {
+  while (bit_count_ < count) {
+    bits_ |= (uint32_t) byte_() << bit_count_;
+    bit_count_ += 8;
+  }
+  uint32_t value = bits_ & ((1UL << count) - 1);
+  bits_ >>= count;
+  bit_count_ -= count;
+  return value;
+}
+
+bool GzipDecoder::skip_header_() {
+  uint8_t header[10];
+  for (auto &byte: header) {
+    byte = byte_();
+  }
+  if (!ok_ || header[0] != 0x1f || header[1] != 0x8b || header[2] != 8) {
+    return false;
+  }
+  uint8_t flags = header[3];
+  if (flags & 4) {
+    // FEXTRA
+    size_t length = byte_();
+    length |= byte_() << 8;
+    while (length-- > 0 && ok_) {
+      byte_();
+    }
+  }
+  for (uint8_t flag: {8, 16}) {
+    // FNAME and FCOMMENT are zero terminated
+    if (flags & flag) {
+      while (byte_() != 0 && ok_) {
+      }
+    }
+  }
+  if (flags & 2) {
+    // FHCRC
+    byte_();
+    byte_();
+  }
+  return ok_;
+}
+
+bool GzipDecoder::stored_() {
+  bits_ = 0;
+  bit_count_ = 0;
+  size_t length = byte_();
+  length |= byte_() << 8;
+  size_t complement = byte_();
+  complement |= byte_() << 8;
+  if (length != (~complement & 0xffff)) {
+    return false;
+  }
+  while (length-- > 0 && ok_) {
+    put_(byte_());
+  }
+  return ok_;
+}
+
+bool GzipDecoder::dynamic_() {
+  size_t length_count = bits_in_(5) + 257;
+  size_t distance_count = bits_in_(5) + 1;
+  size_t code_count = bits_in_(4) + 4;
+  if (length_count > 286 || distance_count > 30) {
+    return false;
+  }
+
+  uint8_t code_lengths[286 + 30];
+  std::memset(code_lengths, 0, 19);
+  for (size_t i = 0; i < code_count; i++) {
+    code_lengths[CODE_LENGTH_ORDER[i]] = bits_in_(3);
+  }
+  std::unique_ptr<Huffman> lengths(new (std::nothrow) Huffman);
+  std::unique_ptr<Huffman> distances(new (std::nothrow) Huffman);
+  if (!lengths || !distances) {
+    out_of_memory_ = true;
+    return false;
+  }
+  if (!build_(*lengths, code_lengths, 19)) {
+    return false;
+  }
+
+  // lengths of both codes are themselves Huffman coded, with runs
+  size_t i = 0;
+  while (i < length_count + distance_count && ok_) {
+    int symbol = decode_(*lengths);
+    if (symbol < 0) {
+      return false;
+    }
+    if (symbol < 16) {
+      code_lengths[i++] = symbol;
+      continue;
+    }
+    uint8_t value = 0;
+    size_t repeat;
+    if (symbol == 16) {
+      if (i == 0) {
+        return false;
+      }
+      value = code_lengths[i - 1];
+      repeat = 3 + bits_in_(2);
+    } else if (symbol == 17) {
+      repeat = 3 + bits_in_(3);
+    } else {
+      repeat = 11 + bits_in_(7);
+    }
+    if (i + repeat > length_count + distance_count) {
+      return false;
+    }
+    while (repeat-- > 0) {
+      code_lengths[i++] = value;
+    }
+  }
+  if (!ok_ || code_lengths[END_OF_BLOCK] == 0) {
+    return false;
+  }
+  if (!build_(*lengths, code_lengths, length_count) ||
+      !build_(*distances, code_lengths + length_count, distance_count)) {
+    return false;
+  }
+  return codes_(*lengths, *distances);
+}
+
+bool GzipDecoder::codes_(const Huffman &lengths, const Huffman &distances) {
+  while (ok_) {
+    int symbol = decode_(lengths);
+    if (symbol < 0) {
+      return false;
+    }
+    if (symbol < 256) {
+      put_(symbol);
+      continue;
+    }
+    if (symbol == END_OF_BLOCK) {
+      return true;
+    }
+    symbol -= 257;
+    if (symbol >= 29) {
+      return false;
+    }
+    size_t length = LENGTH_BASE[symbol] + bits_in_(LENGTH_EXTRA[symbol]);
+    symbol = decode_(distances);
+    if (symbol < 0 || symbol >= 30) {
+      return false;
+    }
+    size_t distance = DISTANCE_BASE[symbol] + bits_in_(DISTANCE_EXTRA[symbol]);
+    if (distance > written_) {
+      return false;
+    }
+    while (length-- > 0) {
+      put_(window_[(written_ - distance) % INFLATE_WINDOW_SIZE]);
+    }
+  }
+  return false;
+}
+
+int GzipDecoder::decode_(const Huffman &huffman) {
+  // canonical codes of one length are consecutive, so one bit at a time is enough
+  int code = 0;
+  int first = 0;
+  int index = 0;
+  for (size_t length = 1; length < 16; length++) {
+    code |= bits_in_(1);
+    int count = huffman.count[length];
+    if (code - count < first) {
+      return huffman.symbol[index + (code - first)];
+    }
+    index += count;
+    first += count;
+    first <<= 1;
+    code <<= 1;
+  }
+  return -1;
+}
+
+constexpr bool GzipDecoder::build_(Huffman &huffman, const uint8_t *lengths, size_t count) {
+  for (auto &n: huffman.count) {
+    n = 0;
+  }
+  for (size_t i = 0; i < count; i++) {
+    huffman.count[lengths[i]]++;
+  }
+  // an over-subscribed code is corrupt, an incomplete one is fine
+  int left = 1;
+  for (size_t length = 1; length < 16; length++) {
+    left <<= 1;
+    left -= huffman.count[length];
+    if (left < 0) {
+      return false;
+    }
+  }
+  uint16_t offsets[16]{};
+  for (size_t length = 1; length < 15; length++) {
+    offsets[length + 1] = offsets[length] + huffman.count[length];
+  }
+  for (size_t i = 0; i < count; i++) {
+    if (lengths[i] != 0) {
+      huffman.symbol[offsets[lengths[i]]++] = i;
+    }
+  }
+  return true;
+}
+
+constexpr GzipDecoder::Huffman GzipDecoder::fixed_code_(bool distances) {
+  uint8_t lengths[288]{};
+  size_t count = distances ? 30 : 288;
+  for (size_t i = 0; i < count; i++) {
+    lengths[i] = distances ? 5 : i < 144 ? 8 : i < 256 ? 9 : i < 280 ? 7 : 8;
+  }
+  Huffman huffman{};
+  build_(huffman, lengths, count);
+  return huffman;
+}
+
+bool GzipDecoder::fixed_() {
+  // built at compile time, so every decoder on any task shares them without setting anything up
+  static constexpr Huffman LENGTHS = fixed_code_(false);
+  static constexpr Huffman DISTANCES = fixed_code_(true);
+  return codes_(LENGTHS, DISTANCES);
+}
+
+void GzipDecoder::put_(uint8_t byte) {
+  window_[written_ % INFLATE_WINDOW_SIZE] = byte;
+  written_++;
+  if (written_ % (INFLATE_WINDOW_SIZE / 2) == 0) {
+    flush_(1);
+  }
+}
+
+void GzipDecoder::flush_(size_t min_length) {
+  size_t pending = written_ - flushed_;
+  if (pending < min_length || !ok_) {
+    return;
+  }
+  // pending never wraps, it is flushed every half window
+  const uint8_t *data = window_.get() + flushed_ % INFLATE_WINDOW_SIZE;
+  crc_ = crc32(crc_, data, pending);
+  ok_ = sink_(reinterpret_cast<const char*>(data), pending);
+  flushed_ = written_;
+}
+
+}  // namespace acl
+}  // namespace esphome
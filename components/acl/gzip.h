@@ -0,0 +1,108 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+
+namespace esphome {
+namespace acl {
+
+static const size_t GZIP_WINDOW_SIZE = 4096;
+static const size_t GZIP_HASH_SIZE = 1024;
+static const size_t GZIP_OUTPUT_SIZE = 512;
+/// Largest distance a deflate stream may refer back, so what the decoder has to keep.
+static const size_t INFLATE_WINDOW_SIZE = 32768;
+
+uint32_t crc32(uint32_t crc, const uint8_t *data, size_t length);
+
+/// Streaming gzip writer. It only uses fixed Huffman codes and finds matches in a
+/// 4KB window with a single hash candidate, which keeps it at about 11KB of memory
+/// while still shrinking repetitive text such as logs several times.
+class GzipEncoder {
+  public:
+    using Sink = std::function<bool(const char*, const size_t)>;
+
+    explicit GzipEncoder(Sink sink);
+
+    /// True if its buffers could not be allocated, it then refuses all data.
+    bool out_of_memory() const { return !buffer_ || !head_; }
+    /// Both return false once the sink refused data.
+    bool write(const char *data, size_t length);
+    bool finish();
+
+  protected:
+    Sink sink_;
+    std::unique_ptr<uint8_t[]> buffer_;
+    std::unique_ptr<uint16_t[]> head_;
+    size_t length_{0};
+    size_t pos_{0};
+    uint32_t crc_{0};
+    uint32_t size_{0};
+    uint32_t bits_{0};
+    uint8_t bit_count_{0};
+    std::string output_;
+    bool ok_{true};
+
+    void encode_(bool flush);
+    void slide_();
+    uint16_t hash_(size_t pos) const;
+    void put_bits_(uint32_t value, uint8_t count);
+    void put_code_(uint32_t code, uint8_t length);
+    void put_symbol_(uint16_t symbol);
+    void put_match_(size_t length, size_t distance);
+    void put_byte_(uint8_t byte);
+    void flush_output_(size_t min_length);
+};
+
+/// Streaming gzip reader. Input is pulled from the source as it is needed, which
+/// returns the number of bytes read, 0 at the end or a negative value on error.
+/// Inflated data goes to the sink. Needs a 32KB window while it runs.
+class GzipDecoder {
+  public:
+    using Source = std::function<int(char*, size_t)>;
+    using Sink = std::function<bool(const char*, const size_t)>;
+
+    GzipDecoder(Source source, Sink sink): source_(source), sink_(sink) {}
+
+    /// Inflates the whole stream. Returns false on corrupt or truncated input, a failing
+    /// source, a refused write or if the window could not be allocated.
+    bool run();
+    bool out_of_memory() const { return out_of_memory_; }
+
+  protected:
+    struct Huffman {
+      uint16_t count[16];
+      uint16_t symbol[288];
+    };
+
+    Source source_;
+    Sink sink_;
+    std::unique_ptr<uint8_t[]> window_;
+    size_t written_{0};
+    size_t flushed_{0};
+    uint32_t crc_{0};
+    char input_[256];
+    size_t input_length_{0};
+    size_t input_pos_{0};
+    uint32_t bits_{0};
+    uint8_t bit_count_{0};
+    bool ok_{true};
+    bool out_of_memory_{false};
+
+    int byte_();
+    uint32_t bits_in_(uint8_t count);
+    bool skip_header_();
+    bool stored_();
+    bool fixed_();
+    bool dynamic_();
+    bool codes_(const Huffman &lengths, const Huffman &distances);
+    int decode_(const Huffman &huffman);
+    static constexpr bool build_(Huffman &huffman, const uint8_t *lengths, size_t count);
+    static constexpr Huffman fixed_code_(bool distances);
+    void put_(uint8_t byte);
+    void flush_(size_t min_length);
+};
+
+}  // namespace acl
+}  // namespace esphome
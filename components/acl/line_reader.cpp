@@ -0,0 +1,68 @@
+#include "line_reader.h"
+
+#include <cstring>
+
+namespace esphome {
+namespace acl {
+
+bool LineReader::feed(const char *data, size_t length) {
+  if (failed_) {
+    return false;
+  }
+  const char *end = data + length;
+  while (data < end) {
+    const char *nl = static_cast<const char*>(memchr(data, '\n', end - data));
+    if (nl == nullptr) {
+      if (carry_.length() + (end - data) > max_length_) {
+        failed_ = true;
+        return false;
+      }
+      carry_.append(data, end - data);
+      return true;
+    }
+    if (carry_.empty()) {
+      if (!emit_(std::string_view(data, nl - data))) {
+        return false;
+      }
+    } else {
+      carry_.append(data, nl - data);
+      if (!emit_(carry_)) {
+        return false;
+      }
+      carry_.clear();
+    }
+    data = nl + 1;
+  }
+  return true;
+}
+
+bool LineReader::finish() {
+  if (failed_) {
+    return false;
+  }
+  if (carry_.empty()) {
+    return true;
+  }
+  bool res = emit_(carry_);
+  carry_.clear();
+  return res;
+}
+
+bool LineReader::emit_(std::string_view line) {
+  line_number_++;
+  if (line.length() > max_length_) {
+    failed_ = true;
+    return false;
+  }
+  if (!line.empty() && line.back() == '\r') {
+    line.remove_suffix(1);
+  }
+  if (!callback_(line)) {
+    failed_ = true;
+    return false;
+  }
+  return true;
+}
+
+}  // namespace acl
+}  // namespace esphome
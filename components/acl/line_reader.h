@@ -0,0 +1,39 @@
+#pragma once
+
+#include <functional>
+#include <string>
+#include <string_view>
+
+namespace esphome {
+namespace acl {
+
+static const size_t MAX_LINE_LENGTH = 256;
+
+/// Splits a stream fed in arbitrary chunks into lines. Only a line that crosses a
+/// chunk boundary is copied, into a carry buffer of at most max_length bytes.
+class LineReader {
+  public:
+    using Callback = std::function<bool(std::string_view)>;
+
+    LineReader(Callback callback, size_t max_length = MAX_LINE_LENGTH): callback_(callback), max_length_(max_length) {}
+
+    /// Returns false if a line is longer than max_length or the callback rejected a line.
+    bool feed(const char *data, size_t length);
+    /// Emits a trailing line without a newline, if any.
+    bool finish();
+
+    size_t line_number() const { return line_number_; }
+    bool failed() const { return failed_; }
+
+  protected:
+    Callback callback_;
+    size_t max_length_;
+    std::string carry_;
+    size_t line_number_{0};
+    bool failed_{false};
+
+    bool emit_(std::string_view line);
+};
+
+}  // namespace acl
+}  // namespace esphome
@@ -1,5 +1,7 @@
 #pragma once
 
+#include <cstdint>
+#include <memory>
 #include <string>
 
 namespace esphome {
@@ -16,5 +18,15 @@ std::string string_format( const std::string& format, Args ... args )
   return std::string( buf.get(), buf.get() + size - 1 ); // We don't want the '\0' inside
 }
 
+/// 32-bit FNV-1a, used for ACL key hashing. Pass the previous result as hash to
+/// continue over several buffers.
+inline uint32_t fnv1a_hash(const char *data, size_t length, uint32_t hash = 2166136261UL) {
+  for (size_t i = 0; i < length; i++) {
+    hash ^= (uint8_t) data[i];
+    hash *= 16777619UL;
+  }
+  return hash;
+}
+
 }  // namespace acl
 }  // namespace esphome
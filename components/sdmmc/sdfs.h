@@ -3,6 +3,7 @@
 #include <string>
 #include <optional>
 #include <functional>
+#include <ctime>
 
 #include "esphome/core/hal.h"
 #include "esphome/core/optional.h"
@@ -18,6 +19,11 @@ enum CardType {
   SDHC
 };
 
+struct FileInfo {
+  size_t size;
+  time_t mtime;
+};
+
 class SdFs;
 
 class SdImpl {
@@ -37,6 +43,11 @@ class SdImpl {
 
 class SdFs {
   public:
+    /// Sink handed to streaming writers; returns false once a write failed.
+    using Writer = std::function<bool(const char*, const size_t)>;
+    /// Source handed to pulling readers; fills the buffer and returns the bytes read, 0 at the end or -1 on error.
+    using Reader = std::function<int(char*, const size_t)>;
+
     SdFs(CardType card_type, std::function<void()> update_callback) : card_type_(card_type), update_callback_(update_callback) {
     }
     CardType card_type() { return card_type_; };
@@ -45,11 +56,18 @@ class SdFs {
 
     bool exists(const std::string &path);
     bool is_directory(const std::string &path);
+    optional<FileInfo> file_info(const std::string &path);
     bool create_dir(const std::string &path);
     bool remove_dir(const std::string &path);
     bool read_file(const std::string &path, std::function<bool(const char*, const size_t)> callback);
+    /// Reads at most length bytes starting at offset.
+    bool read_file(const std::string &path, size_t offset, size_t length, std::function<bool(const char*, const size_t)> callback);
+    /// Keeps the file open while the callback pulls data from it, for decoders that cannot be pushed to.
+    bool read_file(const std::string &path, std::function<bool(const Reader&)> callback);
     bool write_file(const std::string &path, const std::string &message);
     bool append_file(const std::string &path, const std::string &message);
+    bool write_file(const std::string &path, std::function<bool(const Writer&)> callback);
+    bool append_file(const std::string &path, std::function<bool(const Writer&)> callback);
     bool rename_file(const std::string &path1, const std::string &path2);
     bool delete_file(const std::string &path);
     bool list_dir(const std::string &dirname, std::function<bool(const std::string&)> callback);
@@ -73,6 +91,7 @@ class SdFs {
     uint64_t used_bytes_{0};
 
     std::string full_path_(const std::string &path);
+    bool write_file_(const std::string &path, const char *mode, std::function<bool(const Writer&)> callback);
 
 };
 
@@ -2,6 +2,8 @@
 #include "sdfs.h"
 #include "esphome/core/log.h"
 
+#include <algorithm>
+#include <cstring>
 #include <sys/unistd.h>
 #include <sys/stat.h>
 #include <dirent.h>
@@ -183,6 +185,15 @@ bool SdFs::is_directory(const std::string &path) {
   return false;
 }
 
+optional<FileInfo> SdFs::file_info(const std::string &path) {
+  const std::string fpath = full_path_(path);
+  struct stat st;
+  if (stat(fpath.c_str(), &st) != 0 || S_ISDIR(st.st_mode)) {
+    return {};
+  }
+  return FileInfo{(size_t) st.st_size, st.st_mtime};
+}
+
 bool SdFs::list_dir(const std::string &path, std::function<bool(const std::string&)> callback) {
   const std::string fpath = full_path_(path);
 
@@ -202,6 +213,10 @@ bool SdFs::list_dir(const std::string &path, std::function<bool(const std::strin
 }
 
 bool SdFs::read_file(const std::string &path, std::function<bool(const char*, const size_t)> callback) {
+  return read_file(path, 0, SIZE_MAX, callback);
+}
+
+bool SdFs::read_file(const std::string &path, size_t offset, size_t length, std::function<bool(const char*, const size_t)> callback) {
   const std::string fpath = full_path_(path);
   ESP_LOGD(TAG, "Reading file %s", fpath.c_str());
   FILE *f = fopen(fpath.c_str(), "r");
@@ -209,10 +224,16 @@ bool SdFs::read_file(const std::string &path, std::function<bool(const char*, co
     ESP_LOGE(TAG, "Failed to open file %s for reading", fpath.c_str());
     return false;
   }
+  if (offset > 0 && fseek(f, offset, SEEK_SET) != 0) {
+    ESP_LOGE(TAG, "Failed to seek file %s to %u", fpath.c_str(), (unsigned) offset);
+    fclose(f);
+    return false;
+  }
 
   char buffer[1024];
   size_t s;
-  while(s = fread(&buffer, sizeof buffer[0], sizeof buffer, f)) {
+  while(length > 0 && (s = fread(&buffer, sizeof buffer[0], std::min(sizeof buffer, length), f))) {
+     length -= s;
      if (!callback(buffer, s)) {
        break;
      }
@@ -222,6 +243,24 @@ bool SdFs::read_file(const std::string &path, std::function<bool(const char*, co
   return true;
 }
 
+bool SdFs::read_file(const std::string &path, std::function<bool(const Reader&)> callback) {
+  const std::string fpath = full_path_(path);
+  ESP_LOGD(TAG, "Streaming from file %s", fpath.c_str());
+  FILE *f = fopen(fpath.c_str(), "r");
+  if (f == NULL) {
+    ESP_LOGE(TAG, "Failed to open file %s for reading", fpath.c_str());
+    return false;
+  }
+
+  Reader reader = [f](char *buffer, const size_t length) -> int {
+    size_t s = fread(buffer, 1, length, f);
+    return s == 0 && ferror(f) ? -1 : (int) s;
+  };
+  bool res = callback(reader);
+  fclose(f);
+  return res;
+}
+
 bool SdFs::create_dir(const std::string &path) {
   if (is_directory(path)) {
     return true;
@@ -248,7 +287,7 @@ bool SdFs::remove_dir(const std::string &path) {
 bool SdFs::rename_file(const std::string &path1, const std::string &path2) {
   const std::string fpath1 = full_path_(path1);
   const std::string fpath2 = full_path_(path2);
-  if (!exists(fpath1) || exists(fpath2)) {
+  if (!exists(path1) || exists(path2)) {
     return false;
   }
 
@@ -276,7 +315,7 @@ bool SdFs::write_file(const std::string &path, const std::string &data) {
     return false;
   }
 
-  ESP_LOGD(TAG, "Writing %d bytes", data.length());
+  ESP_LOGD(TAG, "Writing %u bytes", (unsigned) data.length());
   auto rc = fwrite(data.c_str(), 1, data.length(), f);
   fclose(f);
 
@@ -301,6 +340,61 @@ bool SdFs::append_file(const std::string &path, const std::string &data) {
   return rc == data.length();
 }
 
+bool SdFs::write_file(const std::string &path, std::function<bool(const Writer&)> callback) {
+  return write_file_(path, "w", callback);
+}
+
+bool SdFs::append_file(const std::string &path, std::function<bool(const Writer&)> callback) {
+  return write_file_(path, "a", callback);
+}
+
+bool SdFs::write_file_(const std::string &path, const char *mode, std::function<bool(const Writer&)> callback) {
+  const std::string fpath = full_path_(path);
+
+  ESP_LOGD(TAG, "Streaming to file %s", fpath.c_str());
+  FILE *f = fopen(fpath.c_str(), mode);
+  if (f == NULL) {
+    ESP_LOGE(TAG, "Failed to open file %s for writing", fpath.c_str());
+    return false;
+  }
+
+  // small writes are gathered so that the card sees whole blocks
+  char buffer[1024];
+  size_t used = 0;
+  bool ok = true;
+  auto flush = [&]() -> bool {
+    if (used > 0 && fwrite(buffer, 1, used, f) != used) {
+      ok = false;
+    }
+    used = 0;
+    return ok;
+  };
+  Writer writer = [&](const char *data, const size_t length) -> bool {
+    if (!ok) {
+      return false;
+    }
+    if (used + length > sizeof buffer) {
+      if (!flush()) {
+        return false;
+      }
+      if (length > sizeof buffer) {
+        ok = fwrite(data, 1, length, f) == length;
+        return ok;
+      }
+    }
+    memcpy(buffer + used, data, length);
+    used += length;
+    return true;
+  };
+
+  bool res = callback(writer);
+  flush();
+  fclose(f);
+
+  update_usage();
+  return res && ok;
+}
+
 }  // namespace sdmmc
 }  // namespace esphome
 
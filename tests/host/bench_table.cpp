@@ -0,0 +1,124 @@
+// Compares AclTable with the std::map<std::string, AclEntry> the component kept its entries in before:
+// heap bytes and allocations to hold n entries, and the time of a lookup of each key. The table's
+// bytes are those it holds once filled, the allocations include the ones it grew through.
+// Keys are 10 digits and names 12 characters, two keys to a name, like a list of card numbers.
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <map>
+#include <new>
+#include <string>
+#include <vector>
+
+#include "esphome/components/acl/acl_table.h"
+
+static size_t allocated_bytes = 0;
+static size_t allocations = 0;
+
+static void *counted_alloc(size_t size) {
+  allocated_bytes += size;
+  allocations++;
+  return malloc(size == 0 ? 1 : size);
+}
+
+void *operator new(size_t size) {
+  void *p = counted_alloc(size);
+  if (p == nullptr) {
+    throw std::bad_alloc();
+  }
+  return p;
+}
+void *operator new[](size_t size) { return operator new(size); }
+// not inlined, or gcc takes the free() of what operator new returned for a mismatch
+__attribute__((noinline)) void operator delete(void *p) noexcept { free(p); }
+void operator delete[](void *p) noexcept { operator delete(p); }
+void operator delete(void *p, size_t) noexcept { operator delete(p); }
+void operator delete[](void *p, size_t) noexcept { operator delete(p); }
+
+using esphome::acl::AclTable;
+
+/// The entry the map held per key.
+struct AclEntry {
+  std::string name;
+  std::string key;
+};
+
+static const int ROUNDS = 20;
+
+static std::string key_for(int i) {
+  char key[16];
+  snprintf(key, sizeof key, "%010u", (unsigned) (i * 2654435761u));
+  return key;
+}
+
+static std::string name_for(int i) {
+  char name[24];
+  snprintf(name, sizeof name, "Person %05d", i / 2);
+  return name;
+}
+
+/// Nanoseconds per call of found(key) over all keys.
+template<typename F> static double time_lookups(const std::vector<std::string> &keys, F found) {
+  size_t hits = 0;
+  auto start = std::chrono::steady_clock::now();
+  for (int r = 0; r < ROUNDS; r++) {
+    for (auto const& key: keys) {
+      hits += found(key);
+    }
+  }
+  auto elapsed = std::chrono::steady_clock::now() - start;
+  if (hits != ROUNDS * keys.size()) {
+    fprintf(stderr, "bench_table: %zu of %zu lookups found\n", hits, ROUNDS * keys.size());
+    exit(EXIT_FAILURE);
+  }
+  return std::chrono::duration<double, std::nano>(elapsed).count() / (ROUNDS * keys.size());
+}
+
+int main() {
+  printf("%8s  %-30s  %-30s\n", "entries", "std::map", "AclTable");
+  for (int n: {1000, 10000, 50000}) {
+    std::vector<std::string> keys;
+    std::vector<std::string> names;
+    for (int i = 0; i < n; i++) {
+      keys.push_back(key_for(i));
+      names.push_back(name_for(i));
+    }
+
+    size_t bytes = allocated_bytes, count = allocations;
+    auto *map = new std::map<std::string, AclEntry>();
+    for (int i = 0; i < n; i++) {
+      map->emplace(keys[i], AclEntry{names[i], keys[i]});
+    }
+    size_t map_bytes = allocated_bytes - bytes, map_allocations = allocations - count;
+
+    // sized like a load from acl.csv: the pool by the file size, the slots as they fill up
+    size_t file_size = 0;
+    for (int i = 0; i < n; i++) {
+      file_size += names[i].size() + keys[i].size() + 2;
+    }
+    count = allocations;
+    auto *table = new AclTable();
+    table->reserve(0, file_size);
+    for (int i = 0; i < n; i++) {
+      table->insert(names[i], keys[i]);
+    }
+    size_t table_allocations = allocations - count;
+
+    double map_ns = time_lookups(keys, [map](const std::string &key) -> bool { return map->count(key) > 0; });
+    double table_ns = time_lookups(keys, [table](const std::string &key) -> bool {
+      return table->find(key).has_value();
+    });
+
+    char map_column[64], table_column[64];
+    snprintf(map_column, sizeof map_column, "%zu KB / %zu allocs", map_bytes / 1024, map_allocations);
+    snprintf(table_column, sizeof table_column, "%zu KB / %zu allocs", table->memory_usage() / 1024,
+             table_allocations);
+    printf("%8d  %-30s  %-30s\n", n, map_column, table_column);
+    printf("%8s  %-30s  %-30s\n", "lookup", (std::to_string((int) map_ns) + " ns").c_str(),
+           (std::to_string((int) table_ns) + " ns").c_str());
+    delete map;
+    delete table;
+  }
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,106 @@
+// check() must not allocate: it runs on reader tasks and is called for every presented credential.
+// Replaces the global operator new with a counting one, publishes a loaded list with an overlay on
+// top and asserts that a run of granted and denied checks leaves the counter where it was.
+
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+#include <string>
+
+#include "esphome/components/acl/acl.h"
+
+static std::atomic<size_t> allocations{0};
+
+static void *counted_alloc(size_t size) {
+  allocations++;
+  return malloc(size == 0 ? 1 : size);
+}
+
+void *operator new(size_t size) {
+  void *p = counted_alloc(size);
+  if (p == nullptr) {
+    throw std::bad_alloc();
+  }
+  return p;
+}
+void *operator new[](size_t size) { return operator new(size); }
+void *operator new(size_t size, const std::nothrow_t &) noexcept { return counted_alloc(size); }
+void *operator new[](size_t size, const std::nothrow_t &) noexcept { return counted_alloc(size); }
+void operator delete(void *p) noexcept { free(p); }
+void operator delete[](void *p) noexcept { free(p); }
+void operator delete(void *p, size_t) noexcept { free(p); }
+void operator delete[](void *p, size_t) noexcept { free(p); }
+void operator delete(void *p, const std::nothrow_t &) noexcept { free(p); }
+void operator delete[](void *p, const std::nothrow_t &) noexcept { free(p); }
+
+namespace esphome {
+namespace acl {
+
+/// Loads a list without a card.
+class TestAcl : public AclComponent {
+  public:
+    void load(AclTable &&table) { publish_loaded_(std::move(table)); }
+};
+
+}  // namespace acl
+}  // namespace esphome
+
+using esphome::acl::AclTable;
+using esphome::acl::TestAcl;
+
+static const int ENTRIES = 1000;
+static const int CHECKS = 300;
+
+static bool expect(bool condition, const char *what) {
+  if (!condition) {
+    fprintf(stderr, "check_alloc: %s\n", what);
+  }
+  return condition;
+}
+
+int main() {
+  static TestAcl acl;
+  acl.set_path("host");
+  acl.set_log_buffer_size(4 * CHECKS);
+  acl.setup();
+  acl.loop();
+
+  AclTable table;
+  for (int i = 0; i < ENTRIES; i++) {
+    table.insert("Person" + std::to_string(i % 400), std::to_string(100000 + i));
+  }
+  acl.load(std::move(table));
+  // lookups that go through the overlay as well as the base
+  acl.add_acl("Overlay", "overlay-key");
+  acl.remove_acl("Person7");
+
+  bool ok = expect(acl.check("100000").has_value(), "loaded entry not found");
+  ok &= expect(acl.check("overlay-key").has_value(), "overlay entry not found");
+  ok &= expect(!acl.check("100007").has_value(), "removed entry still found");
+
+  char key[16];
+  size_t before = allocations;
+  for (int i = 0; i < CHECKS; i++) {
+    snprintf(key, sizeof key, "%d", 100000 + (i * 37) % ENTRIES);
+    std::string_view view(key);
+    acl.check(view);
+    acl.check(std::string_view("unknown"));
+    acl.check(std::string_view("overlay-key"));
+  }
+  size_t used = allocations - before;
+  printf("%d checks, %zu allocations\n", 3 * CHECKS, used);
+  ok &= expect(used == 0, "check() allocated");
+
+  // a full log buffer drops records instead of growing
+  before = allocations;
+  for (int i = 0; i < 2 * CHECKS; i++) {
+    acl.check(std::string_view("unknown"));
+  }
+  used = allocations - before;
+  printf("%u dropped log records, %zu allocations\n", (unsigned) acl.dropped_logs(), used);
+  ok &= expect(acl.dropped_logs() > 0, "log buffer did not fill up");
+  ok &= expect(used == 0, "check() allocated with a full log buffer");
+
+  return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,52 @@
+#pragma once
+// Host build stand-in for the FAT/SDMMC driver API used by sdfs_esp_idf.cpp. Mounting always fails, the
+// host tests run without a card.
+
+#include <cstddef>
+#include <cstdint>
+
+typedef int esp_err_t;
+#ifndef ESP_OK
+#define ESP_OK 0
+#define ESP_FAIL -1
+#endif
+
+typedef unsigned long DWORD;
+typedef struct {
+  int csize;
+  DWORD n_fatent;
+  DWORD free_clst;
+  int ssize;
+} FATFS;
+typedef int gpio_num_t;
+typedef struct {
+  bool format_if_mount_failed;
+  int max_files;
+  size_t allocation_unit_size;
+} esp_vfs_fat_sdmmc_mount_config_t;
+typedef struct {
+  bool is_sdio;
+  bool is_mmc;
+  uint32_t ocr;
+} sdmmc_card_t;
+typedef struct {
+  int slot;
+  int max_freq_khz;
+  int flags;
+} sdmmc_host_t;
+typedef struct {
+  int flags;
+  int width;
+  gpio_num_t clk, cmd, d0, d1, d2, d3;
+} sdmmc_slot_config_t;
+
+#define SDMMC_HOST_DEFAULT() sdmmc_host_t{1, 20000, 0}
+#define SDMMC_SLOT_CONFIG_DEFAULT() sdmmc_slot_config_t{}
+#define SDMMC_SLOT_FLAG_INTERNAL_PULLUP 1
+
+inline int f_getfree(const char *, DWORD *, FATFS **) { return 1; }
+inline esp_err_t esp_vfs_fat_sdmmc_mount(const char *, const sdmmc_host_t *, const sdmmc_slot_config_t *,
+                                         const esp_vfs_fat_sdmmc_mount_config_t *, sdmmc_card_t **) {
+  return ESP_FAIL;
+}
+inline const char *esp_err_to_name(esp_err_t) { return "ESP_FAIL"; }
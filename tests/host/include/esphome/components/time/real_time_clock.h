@@ -0,0 +1,20 @@
+#pragma once
+
+#include <ctime>
+
+namespace esphome {
+
+struct ESPTime {
+  time_t timestamp;
+};
+
+namespace time {
+
+/// Reads the host clock.
+class RealTimeClock {
+  public:
+    ESPTime now() { return ESPTime{::time(nullptr)}; }
+};
+
+}  // namespace time
+}  // namespace esphome
@@ -0,0 +1,33 @@
+#pragma once
+
+#include <functional>
+#include "esphome/core/helpers.h"
+
+namespace esphome {
+
+template<typename T, typename... X> class TemplatableValue {
+  public:
+    TemplatableValue() {}
+    template<typename V> TemplatableValue(V value) : f_([value](X...) -> T { return value; }) {}
+    bool has_value() const { return static_cast<bool>(f_); }
+    T value(X... x) { return f_(x...); }
+
+  private:
+    std::function<T(X...)> f_;
+};
+
+#define TEMPLATABLE_VALUE_(type, name) \
+ protected: \
+  TemplatableValue<type, Ts...> name##_{}; \
+\
+ public: \
+  template<typename V> void set_##name(V name) { this->name##_ = name; }
+#define TEMPLATABLE_VALUE(type, name) TEMPLATABLE_VALUE_(type, name)
+
+template<typename... Ts> class Action {
+  public:
+    virtual ~Action() = default;
+    virtual void play(Ts... x) = 0;
+};
+
+}  // namespace esphome
@@ -0,0 +1,33 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <string>
+#include "esphome/core/helpers.h"
+#include "esphome/core/optional.h"
+
+namespace esphome {
+
+namespace setup_priority {
+const float DATA = 600.0f;
+const float AFTER_WIFI = 200.0f;
+const float LATE = -100.0f;
+}  // namespace setup_priority
+
+/// Timeouts are accepted and never run.
+class Component {
+  public:
+    virtual ~Component() = default;
+    virtual void setup() {}
+    virtual void loop() {}
+    virtual void dump_config() {}
+    virtual float get_setup_priority() const { return 0.0f; }
+
+  protected:
+    void set_timeout(uint32_t timeout, std::function<void()> &&f) {}
+    void set_timeout(const std::string &name, uint32_t timeout, std::function<void()> &&f) {}
+};
+
+class PollingComponent : public Component {};
+
+}  // namespace esphome
@@ -0,0 +1,20 @@
+#pragma once
+
+#include <cstdint>
+
+namespace esphome {
+
+uint32_t millis();
+
+class GPIOPin {
+  public:
+    virtual ~GPIOPin() = default;
+    virtual bool is_internal() { return true; }
+};
+class InternalGPIOPin : public GPIOPin {
+  public:
+    bool is_inverted() { return false; }
+    uint8_t get_pin() { return 0; }
+};
+
+}  // namespace esphome
@@ -0,0 +1,29 @@
+#pragma once
+
+#include <cstdint>
+#include <mutex>
+
+namespace esphome {
+
+class Mutex {
+  public:
+    void lock() { mutex_.lock(); }
+    bool try_lock() { return mutex_.try_lock(); }
+    void unlock() { mutex_.unlock(); }
+
+  private:
+    std::mutex mutex_;
+};
+
+class LockGuard {
+  public:
+    LockGuard(Mutex &mutex) : mutex_(mutex) { mutex_.lock(); }
+    ~LockGuard() { mutex_.unlock(); }
+
+  private:
+    Mutex &mutex_;
+};
+
+uint32_t random_uint32();
+
+}  // namespace esphome
@@ -0,0 +1,17 @@
+#pragma once
+// Host build stand-in for the ESPHome log macros; errors and warnings go to stderr, the rest is dropped.
+
+#include <cstdarg>
+#include <cstdio>
+
+namespace esphome {
+void host_log(char level, const char *tag, const char *format, ...) __attribute__((format(printf, 3, 4)));
+}  // namespace esphome
+
+#define ESP_LOGE(tag, format, ...) esphome::host_log('E', tag, format, ##__VA_ARGS__)
+#define ESP_LOGW(tag, format, ...) esphome::host_log('W', tag, format, ##__VA_ARGS__)
+#define ESP_LOGI(tag, format, ...) esphome::host_log('I', tag, format, ##__VA_ARGS__)
+#define ESP_LOGD(tag, format, ...) esphome::host_log('D', tag, format, ##__VA_ARGS__)
+#define ESP_LOGV(tag, format, ...) esphome::host_log('V', tag, format, ##__VA_ARGS__)
+#define ESP_LOGCONFIG(tag, format, ...) esphome::host_log('C', tag, format, ##__VA_ARGS__)
+#define LOG_PIN(prefix, pin)
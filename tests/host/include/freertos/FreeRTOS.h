@@ -0,0 +1,16 @@
+#pragma once
+// Host build stand-in for the FreeRTOS types the component uses.
+
+#include <cstddef>
+#include <cstdint>
+
+typedef int BaseType_t;
+typedef unsigned UBaseType_t;
+typedef uint32_t TickType_t;
+
+#define pdTRUE 1
+#define pdFALSE 0
+#define pdPASS 1
+#define portMAX_DELAY 0xffffffffu
+#define tskIDLE_PRIORITY 0
+#define pdMS_TO_TICKS(ms) (ms)
@@ -0,0 +1,84 @@
+// Host build stand-ins for the ESPHome, FreeRTOS and esp_http_server functions the component links against.
+// Nothing is served: the server starts without sockets, queues cannot be created so requests run inline,
+// and queued work runs right away.
+
+#include <chrono>
+#include <cstdarg>
+#include <cstdio>
+#include <cstdlib>
+
+#include <esp_http_server.h>
+#include <freertos/queue.h>
+#include <freertos/task.h>
+#include "esphome/core/hal.h"
+#include "esphome/core/helpers.h"
+#include "esphome/core/log.h"
+
+namespace esphome {
+
+static const auto START = std::chrono::steady_clock::now();
+
+uint32_t millis() {
+  return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - START).count();
+}
+
+uint32_t random_uint32() { return static_cast<uint32_t>(rand()); }
+
+void host_log(char level, const char *tag, const char *format, ...) {
+  if (level != 'E' && level != 'W') {
+    return;
+  }
+  va_list args;
+  va_start(args, format);
+  fprintf(stderr, "[%c][%s] ", level, tag);
+  vfprintf(stderr, format, args);
+  fputc('\n', stderr);
+  va_end(args);
+}
+
+}  // namespace esphome
+
+QueueHandle_t xQueueCreate(UBaseType_t length, UBaseType_t item_size) { return nullptr; }
+BaseType_t xQueueSend(QueueHandle_t queue, const void *item, TickType_t wait) { return pdFALSE; }
+BaseType_t xQueueReceive(QueueHandle_t queue, void *item, TickType_t wait) { return pdFALSE; }
+BaseType_t xTaskCreate(TaskFunction_t task, const char *name, uint32_t stack_size, void *arg, UBaseType_t priority,
+                       TaskHandle_t *handle) {
+  return pdFALSE;
+}
+
+esp_err_t httpd_start(httpd_handle_t *handle, const httpd_config_t *config) {
+  static int server;
+  *handle = &server;
+  return ESP_OK;
+}
+esp_err_t httpd_stop(httpd_handle_t handle) { return ESP_OK; }
+esp_err_t httpd_register_uri_handler(httpd_handle_t handle, const httpd_uri_t *uri_handler) { return ESP_OK; }
+esp_err_t httpd_resp_set_status(httpd_req_t *r, const char *status) { return ESP_OK; }
+esp_err_t httpd_resp_set_type(httpd_req_t *r, const char *type) { return ESP_OK; }
+esp_err_t httpd_resp_set_hdr(httpd_req_t *r, const char *field, const char *value) { return ESP_OK; }
+esp_err_t httpd_resp_send(httpd_req_t *r, const char *buf, ssize_t buf_len) { return ESP_OK; }
+esp_err_t httpd_resp_send_chunk(httpd_req_t *r, const char *buf, ssize_t buf_len) { return ESP_OK; }
+esp_err_t httpd_resp_send_err(httpd_req_t *req, httpd_err_code_t error, const char *msg) { return ESP_OK; }
+int httpd_req_recv(httpd_req_t *r, char *buf, size_t buf_len) { return 0; }
+size_t httpd_req_get_hdr_value_len(httpd_req_t *r, const char *field) { return 0; }
+esp_err_t httpd_req_get_hdr_value_str(httpd_req_t *r, const char *field, char *val, size_t val_size) {
+  return ESP_ERR_NOT_FOUND;
+}
+size_t httpd_req_get_url_query_len(httpd_req_t *r) { return 0; }
+esp_err_t httpd_req_get_url_query_str(httpd_req_t *r, char *buf, size_t buf_len) { return ESP_ERR_NOT_FOUND; }
+esp_err_t httpd_query_key_value(const char *qry, const char *key, char *val, size_t val_size) {
+  return ESP_ERR_NOT_FOUND;
+}
+#if ESP_IDF_VERSION >= ESP_IDF_VERSION_VAL(5, 1, 0)
+esp_err_t httpd_req_async_handler_begin(httpd_req_t *r, httpd_req_t **out) { return ESP_FAIL; }
+esp_err_t httpd_req_async_handler_complete(httpd_req_t *r) { return ESP_OK; }
+#endif
+int httpd_req_to_sockfd(httpd_req_t *r) { return -1; }
+esp_err_t httpd_sess_trigger_close(httpd_handle_t handle, int sockfd) { return ESP_OK; }
+esp_err_t httpd_queue_work(httpd_handle_t handle, httpd_work_fn_t work, void *arg) {
+  work(arg);
+  return ESP_OK;
+}
+int httpd_socket_send(httpd_handle_t hd, int sockfd, const char *buf, size_t buf_len, int flags) {
+  return static_cast<int>(buf_len);
+}